@@ -0,0 +1,181 @@
+/*
+	Lookup throughput and memory of the hash store's in-memory structures at a million
+	depends hashes: CDigestSet (the hashes new in a run) against the set<CDigest> it
+	replaced, and CTargetHashStore looking hashes up in a sorted previous run, as it does
+	in the mapped store file. Build with make bench_digestset; the count can be given.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "hashstore.h"
+
+using namespace std;
+
+static size_t getResidentBytes () {
+
+	// linux only; elsewhere memory is not reported
+
+	ifstream ifs ("/proc/self/statm");
+	size_t total = 0, resident = 0;
+	ifs >> total >> resident;
+
+	return resident * sysconf (_SC_PAGESIZE);
+
+}
+
+static void makeDigests (mt19937_64& random, size_t count, vector<CDigest>& digests) {
+
+	digests.resize (count);
+
+	for (size_t i = 0; i < count; i++) {
+		for (size_t j = 0; j < DIGEST_SIZE; j += 8) {
+			uint64_t value = random ();
+			memcpy (digests[i].bytes + j, &value, min ((size_t) 8, (size_t) DIGEST_SIZE - j));
+		}
+	}
+
+}
+
+class CBenchTimer {
+
+	private:
+
+		chrono::steady_clock::time_point started;
+
+	public:
+
+		CBenchTimer () {
+			started = chrono::steady_clock::now ();
+		}
+
+		void report (const string& what, size_t count) {
+			double seconds = chrono::duration<double> (chrono::steady_clock::now () - started).count ();
+			cout << "  " << left << setw (28) << what << right << fixed << setprecision (1) << setw (8) << (seconds * 1e9 / count) << " ns/op" << setw (10) << setprecision (1) << (count / seconds / 1e6) << " M/s" << endl;
+		}
+
+};
+
+static void reportMemory (const string& what, size_t before, size_t count) {
+
+	size_t after = getResidentBytes ();
+	if (after > before)
+		cout << "  " << left << setw (28) << what << right << fixed << setprecision (1) << setw (8) << ((double) (after - before) / count) << " bytes/entry" << endl;
+
+}
+
+int main (int argc, char *argv[]) {
+
+	size_t count = argc > 1 ? (size_t) atol (argv[1]) : 1000000;
+
+	mt19937_64 random (42);
+	vector<CDigest> present, absent;
+	makeDigests (random, count, present);
+	makeDigests (random, count, absent);
+
+	size_t found = 0;
+
+	cout << count << " digests of " << DIGEST_SIZE << " bytes" << endl;
+
+	{
+		cout << "CDigestSet" << endl;
+
+		size_t before = getResidentBytes ();
+		CDigestSet digestSet;
+
+		CBenchTimer insertTimer;
+		for (size_t i = 0; i < count; i++)
+			digestSet.insert (present[i]);
+		insertTimer.report ("insert", count);
+
+		reportMemory ("memory", before, count);
+
+		CBenchTimer hitTimer;
+		for (size_t i = 0; i < count; i++)
+			found += digestSet.contains (present[i]);
+		hitTimer.report ("contains, present", count);
+
+		CBenchTimer missTimer;
+		for (size_t i = 0; i < count; i++)
+			found += digestSet.contains (absent[i]);
+		missTimer.report ("contains, absent", count);
+	}
+
+	{
+		cout << "set<CDigest>" << endl;
+
+		size_t before = getResidentBytes ();
+		set<CDigest> digestSet;
+
+		CBenchTimer insertTimer;
+		for (size_t i = 0; i < count; i++)
+			digestSet.insert (present[i]);
+		insertTimer.report ("insert", count);
+
+		reportMemory ("memory", before, count);
+
+		CBenchTimer hitTimer;
+		for (size_t i = 0; i < count; i++)
+			found += digestSet.count (present[i]);
+		hitTimer.report ("count, present", count);
+
+		CBenchTimer missTimer;
+		for (size_t i = 0; i < count; i++)
+			found += digestSet.count (absent[i]);
+		missTimer.report ("count, absent", count);
+	}
+
+	{
+		cout << "CTargetHashStore" << endl;
+
+		vector<CDigest> prevRun (present);
+		sort (prevRun.begin (), prevRun.end ());
+
+		size_t before = getResidentBytes ();
+		CTargetHashStore targetStore;
+		targetStore.setPrevRun (prevRun.data (), prevRun.size ());
+
+		// the shuffled order of the lookups is the order blocks would run in
+
+		bool recorded;
+
+		CBenchTimer hitTimer;
+		for (size_t i = 0; i < count; i++)
+			found += targetStore.containsHash (present[i], recorded);
+		hitTimer.report ("containsHash, previous run", count);
+
+		CBenchTimer peekTimer;
+		for (size_t i = 0; i < count; i++)
+			found += targetStore.peekHash (present[i]);
+		peekTimer.report ("peekHash, previous run", count);
+
+		CBenchTimer addTimer;
+		for (size_t i = 0; i < count; i++)
+			found += targetStore.addHash (absent[i]);
+		addTimer.report ("addHash, new", count);
+
+		reportMemory ("memory, seen bits and new", before, count);
+
+		CBenchTimer newTimer;
+		for (size_t i = 0; i < count; i++)
+			found += targetStore.containsHash (absent[i], recorded);
+		newTimer.report ("containsHash, new", count);
+	}
+
+	// keeps the lookups from being optimized away
+
+	if (found == 0)
+		cout << "nothing found" << endl;
+
+	return 0;
+
+}
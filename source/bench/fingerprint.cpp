@@ -0,0 +1,116 @@
+/*
+	SHA1 against XXH3 as lick uses them: many short updates into one fingerprint, as a
+	depends block hashes its names and digests, a fingerprint per short string, as the
+	duration history keys, and files read through update (istream), as the file digests
+	are. Build with make bench_fingerprint; the file size in MB can be given.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+
+#include "fingerprint.h"
+
+using namespace std;
+
+static double getSeconds (chrono::steady_clock::time_point started) {
+	return chrono::duration<double> (chrono::steady_clock::now () - started).count ();
+}
+
+int main (int argc, char *argv[]) {
+
+	size_t fileSizeMB = argc > 1 ? (size_t) atol (argv[1]) : 256;
+	size_t tokenCount = 1000000;
+
+	// tokens like the ones a depends block hashes: paths, flags, hex digests
+
+	mt19937_64 random (42);
+	vector<string> tokens (tokenCount);
+	size_t tokenBytes = 0;
+
+	for (size_t i = 0; i < tokenCount; i++) {
+		stringstream ss;
+		ss << "src/module" << (random () % 100) << "/file" << (random () % 10000) << ".cpp" << hex << random ();
+		tokens[i] = ss.str ();
+		tokenBytes += tokens[i].length ();
+	}
+
+	string fileName = "lick-bench-fingerprint.tmp";
+
+	{
+		ofstream ofs (fileName, ios::binary);
+		vector<uint64_t> block (1 << 17);
+		for (size_t i = 0; i < fileSizeMB; i++) {
+			for (size_t j = 0; j < block.size (); j++)
+				block[j] = random ();
+			ofs.write ((const char *) block.data (), block.size () * sizeof (uint64_t));
+		}
+		if (ofs.fail ()) {
+			cerr << "lick: failed to write " << fileName << endl;
+			return 1;
+		}
+	}
+
+	cout << tokenCount << " tokens of " << (tokenBytes / tokenCount) << " bytes on average, a file of " << fileSizeMB << " MB" << endl;
+
+	FingerprintAlgorithm algorithms[] = { FingerprintSHA1, FingerprintXXH3 };
+	size_t digestBytes = 0;
+
+	for (size_t a = 0; a < 2; a++) {
+
+		CFingerprint::setAlgorithm (algorithms[a]);
+		cout << CFingerprint::getAlgorithmName (algorithms[a]) << endl;
+
+		chrono::steady_clock::time_point started = chrono::steady_clock::now ();
+		shared_ptr<CFingerprint> hash = CFingerprint::create ();
+		for (size_t i = 0; i < tokenCount; i++)
+			hash -> update (tokens[i]);
+		digestBytes += hash -> final ().length ();
+		double seconds = getSeconds (started);
+
+		cout << "  " << left << setw (24) << "updates of one" << right << fixed << setprecision (1) << setw (8) << (seconds * 1e9 / tokenCount) << " ns/token" << setw (10) << (tokenBytes / seconds / 1048576) << " MB/s" << endl;
+
+		started = chrono::steady_clock::now ();
+		for (size_t i = 0; i < tokenCount; i++) {
+			shared_ptr<CFingerprint> tokenHash = CFingerprint::create ();
+			tokenHash -> update (tokens[i]);
+			digestBytes += tokenHash -> final ().length ();
+		}
+		seconds = getSeconds (started);
+
+		cout << "  " << left << setw (24) << "one per token" << right << fixed << setprecision (1) << setw (8) << (seconds * 1e9 / tokenCount) << " ns/token" << setw (10) << (tokenBytes / seconds / 1048576) << " MB/s" << endl;
+
+		// the first read warms the page cache, the second is timed
+
+		for (size_t pass = 0; pass < 2; pass++) {
+
+			started = chrono::steady_clock::now ();
+			ifstream ifs (fileName, ios::binary);
+			shared_ptr<CFingerprint> fileHash = CFingerprint::create ();
+			fileHash -> update (ifs);
+			digestBytes += fileHash -> final ().length ();
+			seconds = getSeconds (started);
+
+			if (pass == 1)
+				cout << "  " << left << setw (24) << "file" << right << fixed << setprecision (1) << setw (8) << (seconds * 1000) << " ms     " << setw (10) << (fileSizeMB / seconds) << " MB/s" << endl;
+
+		}
+
+	}
+
+	remove (fileName.c_str ());
+
+	// keeps the hashing from being optimized away
+
+	if (digestBytes == 0)
+		cout << "no digests" << endl;
+
+	return 0;
+
+}
@@ -0,0 +1,173 @@
+#include <iostream>
+#include <sstream>
+
+#ifdef _MSC_VER
+# include <io.h>
+#else
+# include <unistd.h>
+# include <sys/ioctl.h>
+#endif
+
+#include "console.h"
+#include "threads.h"
+
+CConsole console;
+
+CConsole::CConsole () {
+
+	buffered = false;
+	statusEnabled = false;
+	statusShown = false;
+	atLineStart = true;
+	started = 0;
+	finished = 0;
+
+}
+
+void CConsole::init () {
+
+	buffered = getJobCount () > 1;
+
+	// the status line needs a terminal which understands "erase line"
+
+#ifndef _MSC_VER
+	statusEnabled = buffered && isatty (STDOUT_FILENO);
+#endif
+
+}
+
+bool CConsole::isBuffered () {
+	return buffered;
+}
+
+void CConsole::clearStatus () {
+
+	if (statusShown) {
+		cout << "\r\x1b[K";
+		statusShown = false;
+	}
+
+}
+
+void CConsole::drawStatus () {
+
+	if (!statusEnabled || !atLineStart || started == finished)
+		return;
+
+	size_t width = 80;
+
+#ifndef _MSC_VER
+	struct winsize ws;
+	if (ioctl (STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+		width = ws.ws_col;
+#endif
+
+	stringstream ss;
+	ss << "[" << finished << "/" << started << "] " << lastCommand;
+
+	string status = ss.str ();
+	if (status.length () >= width)
+		status = status.substr (0, width - 4) + "...";
+
+	cout << "\r" << status << "\x1b[K" << flush;
+	statusShown = true;
+
+}
+
+void CConsole::write (const string& text) {
+
+	if (text.empty ())
+		return;
+
+	lock_guard<mutex> guard (consoleLock);
+
+	clearStatus ();
+	cout << text;
+
+	atLineStart = text[text.length () - 1] == '\n';
+
+	if (statusEnabled) {
+		cout << flush;
+		drawStatus ();
+	}
+
+}
+
+void CConsole::error (const string& text) {
+
+	lock_guard<mutex> guard (consoleLock);
+
+	clearStatus ();
+	cout << flush;
+	cerr << text << endl;
+	drawStatus ();
+
+}
+
+void CConsole::commandStarted (const string& commandLine) {
+
+	lock_guard<mutex> guard (consoleLock);
+
+	started ++;
+	lastCommand = commandLine;
+
+	if (statusEnabled) {
+		clearStatus ();
+		drawStatus ();
+	}
+
+}
+
+void CConsole::commandFinished (const string& commandLine, const string& log, int exitCode) {
+
+	lock_guard<mutex> guard (consoleLock);
+
+	finished ++;
+	clearStatus ();
+
+	// in one write, so nothing else can end up in the middle of it
+
+	string text = log;
+	if (!text.empty () && text[text.length () - 1] != '\n')
+		text += "\n";
+
+	if (exitCode != 0) {
+
+		stringstream ss;
+		ss << "FAILED (exit code " << exitCode << "): " << commandLine << "\n";
+		text += ss.str ();
+
+		failures.push_back (ss.str () + log);
+
+	}
+
+	cout << text << flush;
+	atLineStart = true;
+
+	drawStatus ();
+
+}
+
+void CConsole::finish () {
+
+	lock_guard<mutex> guard (consoleLock);
+
+	clearStatus ();
+
+	if (!failures.empty ()) {
+
+		cout << "\n" << failures.size () << " command(s) failed:\n";
+
+		for (list<string>::iterator it = failures.begin (); it != failures.end (); it++) {
+			cout << "\n" << (*it);
+			if (!it -> empty () && (*it)[it -> length () - 1] != '\n')
+				cout << "\n";
+		}
+
+		failures.clear ();
+
+	}
+
+	cout << flush;
+
+}
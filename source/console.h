@@ -0,0 +1,57 @@
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+#include <string>
+#include <list>
+#include <mutex>
+
+using namespace std;
+
+/*
+	All terminal output goes through here. With -j N > 1 the output of every command is
+	captured (stdout and stderr, into a temp file) and written out in one piece when the
+	command ends, so concurrent commands never interleave. On a terminal a single status
+	line shows progress; anything else printed clears it first. Output of failed commands
+	is repeated at the end, where it is easy to find.
+*/
+
+class CConsole {
+
+	private:
+
+		mutex consoleLock;
+
+		bool buffered;
+		bool statusEnabled;
+		bool statusShown;
+		bool atLineStart;
+
+		int started;
+		int finished;
+		string lastCommand;
+
+		list<string> failures;
+
+		void clearStatus ();
+		void drawStatus ();
+
+	public:
+
+		CConsole ();
+
+		void init ();
+		bool isBuffered ();
+
+		void write (const string& text);
+		void error (const string& text);
+
+		void commandStarted (const string& commandLine);
+		void commandFinished (const string& commandLine, const string& log, int exitCode);
+
+		void finish ();
+
+};
+
+extern CConsole console;
+
+#endif /* __CONSOLE_H__ */
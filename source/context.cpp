@@ -1,6 +1,7 @@
 #include "context.h"
 #include "value.h"
 #include "sys_funcs.h"
+#include "outputcache.h"
 
 void CVarStore::initDefaultVars () {
 
@@ -45,6 +46,9 @@ void CVarStore::initDefaultVars () {
 	sys -> append ("env", shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (env))));
 	sys -> append ("path", shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (path))));
 	sys -> append ("include_path", shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (new CArrayValue ()))));
+	sys -> append ("fingerprint", shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (new CStringValue ("stat")))));
+	sys -> append ("output_cache", shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (new CStringValue (envmap["LICK_OUTPUT_CACHE"])))));
+	sys -> append ("output_cache_size", shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (new CIntValue (OUTPUT_CACHE_DEFAULT_SIZE)))));
 	
 	setVar ("sys", shared_ptr<CValue> (sys));
 
@@ -97,6 +101,71 @@ void CVarStore::setVar (const string& varName, shared_ptr<CValue> value) {
 	
 }
 
+CVarStore *CVarStore::getIsolatedStore () {
+
+	for (CVarStore *store = this; store != NULL; store = store -> baseStore.get ())
+		if (store -> isolated)
+			return store;
+	
+	return NULL;
+
+}
+
+shared_ptr<CValue> CVarStore::getVarForUpdate (const string& varName) {
+
+	CVarStore *isolatedStore = getIsolatedStore ();
+	if (isolatedStore == NULL)
+		return getVar (varName);
+	
+	// a variable from outside the isolated store gets a copy there, where it is merged from
+	
+	for (CVarStore *store = this; store != isolatedStore; store = store -> baseStore.get ()) {
+		map<string, shared_ptr<CValueRef>>::iterator it = store -> variables.find (varName);
+		if (it != store -> variables.end ())
+			return getValueForUpdate (it -> second);
+	}
+	
+	return getValueForUpdate (isolatedStore -> getVarRef (varName));
+
+}
+
+shared_ptr<CValue> CVarStore::getValueForUpdate (shared_ptr<CValueRef> ref) {
+
+	shared_ptr<CValue> value = ref -> getValue ();
+	
+	CVarStore *isolatedStore = getIsolatedStore ();
+	if (isolatedStore == NULL || isolatedStore -> ownValues.find (value) != isolatedStore -> ownValues.end ())
+		return value;
+	
+	if (value -> getType () == ValueArray)
+		value = shared_ptr<CValue> (CArrayValue::make_copy (value));
+	else if (value -> getType () == ValueDict)
+		value = shared_ptr<CValue> (CDictValue::make_copy (value));
+	else
+		return value;
+	
+	ref -> setValue (value);
+	isolatedStore -> ownValues.insert (value);
+	
+	return value;
+
+}
+
+bool CVarStore::hasVar (const string& varName) {
+
+	if (variables.find (varName) != variables.end ())
+		return true;
+	
+	return baseStore ? baseStore -> hasVar (varName) : false;
+	
+}
+
+void CVarStore::getLocalVars (map<string, shared_ptr<CValue>>& vars) {
+
+	for (map<string, shared_ptr<CValueRef>>::iterator it = variables.begin (); it != variables.end (); it++)
+		vars[it -> first] = it -> second -> getValue ();
+	
+}
 
 void CBaseExecutionContext::addFunctions (const map<string,shared_ptr<CUserFunction>>& moreFunctions) {
 
@@ -158,7 +227,7 @@ shared_ptr<CValue> CUserFunction::execute (shared_ptr<CExecutionContext> ctx, co
 	
 }
 
-void CUserFunction::updateHash (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CUserFunction::updateHash (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 
 	for (list<string>::iterator it = args.begin (); it != args.end (); it ++) {
 		hash.update (":arg:");
@@ -18,21 +18,37 @@ class CVarStore {
 		shared_ptr<CVarStore> baseStore;
 		map<string, shared_ptr<CValueRef>> variables;
 		
+		// an isolated store keeps arrays and dicts of the stores below it from being
+		// changed in place: they are copied into it first, ownValues are the copies
+		
+		bool isolated;
+		set<shared_ptr<CValue>> ownValues;
+		
 	private:
 	
 		void initDefaultVars ();
+		CVarStore *getIsolatedStore ();
 		
 	public:
 		
 		CVarStore () { 
+			isolated = false;
 			initDefaultVars ();
 		};
 		
-		CVarStore (shared_ptr<CVarStore> p_baseStore): baseStore (p_baseStore) { }
+		CVarStore (shared_ptr<CVarStore> p_baseStore, bool p_isolated = false): baseStore (p_baseStore), isolated (p_isolated) { }
 		
 		shared_ptr<CValue> getVar (const string& varName);
 		shared_ptr<CValueRef> getVarRef (const string& varName);
 		void setVar (const string& varName, shared_ptr<CValue> value);
+		
+		// values whose contents are about to be changed in place
+		
+		shared_ptr<CValue> getVarForUpdate (const string& varName);
+		shared_ptr<CValue> getValueForUpdate (shared_ptr<CValueRef> ref);
+		
+		bool hasVar (const string& varName);
+		void getLocalVars (map<string, shared_ptr<CValue>>& vars);
 	
 };
 
@@ -48,19 +64,35 @@ class CUserFunction {
 		bool isTarget;
 		
 		list<string> args;
+		list<string> prerequisites;
+		double weight;
 		shared_ptr<CStatement> stmt;
 	
 	public:
 		
-		CUserFunction (const string& p_functionName, const list<string>& p_args, shared_ptr<CStatement> p_stmt, bool p_isTarget):
+		CUserFunction (const string& p_functionName, const list<string>& p_args, const list<string>& p_prerequisites, double p_weight, shared_ptr<CStatement> p_stmt, bool p_isTarget):
 			functionName (p_functionName),
 			isTarget (p_isTarget),
 			args (p_args),
+			prerequisites (p_prerequisites),
+			weight (p_weight),
 			stmt (p_stmt) { }
 			
+		bool isTargetFunction () {
+			return isTarget;
+		}
+		
+		const list<string>& getPrerequisites () {
+			return prerequisites;
+		}
+		
+		double getWeight () {
+			return weight;
+		}
+			
 		shared_ptr<CValue> execute (shared_ptr<CExecutionContext> ctx, const vector<shared_ptr<CExpression>>& invoke_args);
 
-		void updateHash (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHash (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 	
 };
 
@@ -144,6 +176,18 @@ class CExecutionContext {
 			
 		}
 		
+		shared_ptr<CExecutionContext> enterScope (bool isolated = false) {
+			
+			CExecutionContext *newCtx = new CExecutionContext (*this);
+			newCtx -> varStore = shared_ptr<CVarStore> (new CVarStore (varStore, isolated));
+			newCtx -> breakSignaled = false;
+			newCtx -> continueSignaled = false;
+			newCtx -> returnSignaled = false;
+			
+			return shared_ptr<CExecutionContext> (newCtx);
+			
+		}
+		
 		void returnValue (shared_ptr<CValue> p_retValue) {
 			retValue -> setValue (p_retValue);
 			returnSignaled = true;
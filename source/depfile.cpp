@@ -0,0 +1,111 @@
+#include <fstream>
+#include <set>
+
+#include "depfile.h"
+#include "sys_funcs.h"
+
+CDepfileStore depfileStore;
+
+bool CDepfileStore::parse (const string& fileName, const string& baseDirectory, vector<string>& files) {
+
+	ifstream ifs (makeSysSeparators (fileName), ios::binary);
+	if (!ifs.is_open ())
+		return false;
+
+	string data ((istreambuf_iterator<char> (ifs)), istreambuf_iterator<char> ());
+
+	// make syntax as compilers write it: "target ...: prerequisite ..." with backslash-newline
+	// continuations, "\ " for spaces and "$$" for dollars in names; other backslashes are
+	// taken literally, they are path separators on windows
+
+	set<string> seen;
+	vector<string> words;
+	string word;
+	bool inWord = false;
+	bool comment = false;
+
+	auto endWord = [&] () {
+		if (inWord)
+			words.push_back (word);
+		word.clear ();
+		inWord = false;
+	};
+
+	auto endLine = [&] () {
+
+		endWord ();
+
+		size_t i = 0;
+		while (i < words.size () && words[i] != ":" && (words[i].empty () || words[i][words[i].length () - 1] != ':'))
+			i++;
+
+		for (i++; i < words.size (); i++) {
+
+			string name = makeSysSeparators (words[i]);
+			if (!isAbsolutePath (name))
+				name = baseDirectory + getPathSeparator () + name;
+
+			if (seen.insert (name).second)
+				files.push_back (name);
+
+		}
+
+		words.clear ();
+		comment = false;
+
+	};
+
+	for (size_t pos = 0; pos < data.length (); pos++) {
+
+		char c = data[pos];
+
+		if (c == '\n') {
+			endLine ();
+			continue;
+		}
+
+		if (comment || c == '\r')
+			continue;
+
+		if (c == '\\' && pos + 1 < data.length ()) {
+			char next = data[pos + 1];
+			if (next == '\n' || (next == '\r' && pos + 2 < data.length () && data[pos + 2] == '\n')) {
+				endWord ();
+				pos += next == '\r' ? 2 : 1;
+				continue;
+			}
+			if (next == ' ' || next == '#') {
+				word.push_back (next);
+				inWord = true;
+				pos++;
+				continue;
+			}
+		}
+
+		if (c == '$' && pos + 1 < data.length () && data[pos + 1] == '$') {
+			word.push_back ('$');
+			inWord = true;
+			pos++;
+			continue;
+		}
+
+		if (c == '#' && !inWord) {
+			comment = true;
+			continue;
+		}
+
+		if (c == ' ' || c == '\t') {
+			endWord ();
+			continue;
+		}
+
+		word.push_back (c);
+		inWord = true;
+
+	}
+
+	endLine ();
+
+	return true;
+
+}
@@ -0,0 +1,43 @@
+#ifndef __DEPFILE_H__
+#define __DEPFILE_H__
+
+#include <string>
+#include <vector>
+
+#include "keyedstore.h"
+
+using namespace std;
+
+/*
+	Inputs discovered by depends blocks with a depfile: option, kept in .lick/depfiles next
+	to the hash store. After the action of such a block runs, the Makefile-syntax dependency
+	file written by the compiler (gcc / clang -MD, -MMD) is read, and its prerequisites are
+	stored under the block's key (module, target and depfile); the next run fingerprints
+	them together with the inputs the script lists. Every input is a line of the key's.
+*/
+
+#define DEPFILE_MAX_ENTRIES 20000
+
+class CDepfileStore: public CKeyedStore {
+
+	public:
+
+		CDepfileStore (): CKeyedStore ("depfiles", DEPFILE_MAX_ENTRIES) { }
+
+		bool getInputs (const string& key, vector<string>& files) {
+			return getLines (key, files);
+		}
+
+		void setInputs (const string& key, const vector<string>& files) {
+			setLines (key, files);
+		}
+
+		// prerequisites of all rules in fileName, relative ones made absolute against baseDirectory
+
+		static bool parse (const string& fileName, const string& baseDirectory, vector<string>& files);
+
+};
+
+extern CDepfileStore depfileStore;
+
+#endif /* __DEPFILE_H__ */
@@ -0,0 +1,64 @@
+#include <map>
+#include <set>
+
+#include "explain.h"
+
+CComponentStore componentStore;
+
+bool CComponentStore::getComponents (const string& key, CComponentList& result) {
+
+	vector<string> lines;
+	if (!getLines (key, lines))
+		return false;
+
+	result.clear ();
+
+	for (size_t i = 0; i < lines.size (); i++) {
+		size_t pos = lines[i].find ('\t');
+		if (pos != string::npos)
+			result.push_back (pair<string,string> (lines[i].substr (0, pos), lines[i].substr (pos + 1)));
+	}
+
+	return true;
+
+}
+
+void CComponentStore::setComponents (const string& key, const CComponentList& list) {
+
+	vector<string> lines;
+	for (size_t i = 0; i < list.size (); i++)
+		lines.push_back (list[i].first + "\t" + list[i].second);
+
+	setLines (key, lines);
+
+}
+
+void CComponentStore::explain (const CComponentList& previous, const CComponentList& current, vector<string>& reasons) {
+
+	map<string,string> before (previous.begin (), previous.end ());
+	set<string> seen;
+
+	for (size_t i = 0; i < current.size (); i++) {
+
+		const string& name = current[i].first;
+		const string& value = current[i].second;
+		seen.insert (name);
+
+		map<string,string>::iterator it = before.find (name);
+
+		if (it == before.end ())
+			reasons.push_back (name + " is new");
+		else if (it -> second != value) {
+			if (value.find (":not exists:") != string::npos)
+				reasons.push_back (name + " is missing");
+			else
+				reasons.push_back (name + " changed");
+		}
+
+	}
+
+	for (size_t i = 0; i < previous.size (); i++)
+		if (seen.find (previous[i].first) == seen.end ())
+			reasons.push_back (previous[i].first + " is gone");
+
+}
@@ -0,0 +1,40 @@
+#ifndef __EXPLAIN_H__
+#define __EXPLAIN_H__
+
+#include <string>
+#include <vector>
+
+#include "keyedstore.h"
+
+using namespace std;
+
+typedef vector<pair<string,string>> CComponentList;
+
+/*
+	The parts a depends hash was made of when its action last ran, kept in .lick/components
+	next to the hash store, so lick --explain and --dry-run can tell which of them changed.
+	A block is keyed by module, target, location and the names of its listed inputs and
+	outputs; a component is a name ("input x.c", "output x.o", "action") and the hash
+	input it contributed, a line of the key's as the name, a tab and the value.
+*/
+
+#define COMPONENTS_MAX_ENTRIES 100000
+
+class CComponentStore: public CKeyedStore {
+
+	public:
+
+		CComponentStore (): CKeyedStore ("components", COMPONENTS_MAX_ENTRIES) { }
+
+		bool getComponents (const string& key, CComponentList& result);
+		void setComponents (const string& key, const CComponentList& list);
+
+		// what differs between two component lists, in words
+
+		static void explain (const CComponentList& previous, const CComponentList& current, vector<string>& reasons);
+
+};
+
+extern CComponentStore componentStore;
+
+#endif /* __EXPLAIN_H__ */
@@ -54,7 +54,7 @@ map<string,OpCode> initPostfixOps () {
 
 map<string,OpCode> CExpression::postfixOps = initPostfixOps ();
 
-void CExpression::updateHash (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CExpression::updateHash (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 
 	if (this == NULL)
 		hash.update ("null");
@@ -382,7 +382,7 @@ shared_ptr<CValue> CUnaryOperation::evaluate (shared_ptr<CExecutionContext> ctx)
 	
 }
 
-void CUnaryOperation::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CUnaryOperation::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	stringstream ss;
 	ss << (postfix ? "postfix":"prefix");
 	ss << op << ":";
@@ -390,7 +390,7 @@ void CUnaryOperation::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& h
 	arg -> updateHash (ctx, hash);
 }
 
-void CTernaryOperation::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CTernaryOperation::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	cond -> updateHash (ctx, hash);
 	trueExpr -> updateHash (ctx, hash);
 	falseExpr -> updateHash (ctx, hash);
@@ -410,7 +410,7 @@ shared_ptr<CValueRef> CBinaryOperation::evalRef (shared_ptr<CExecutionContext> c
 
 	if (op == OpSubscript) {
 		
-		shared_ptr<CValue> left = lhs -> evaluate (ctx);
+		shared_ptr<CValue> left = lhs -> evalForUpdate (ctx);
 		
 		if (left -> getType () == ValueDict) {
 			string index = rhs -> evaluate (ctx) -> asString ();
@@ -427,6 +427,15 @@ shared_ptr<CValueRef> CBinaryOperation::evalRef (shared_ptr<CExecutionContext> c
 
 }
 
+shared_ptr<CValue> CBinaryOperation::evalForUpdate (shared_ptr<CExecutionContext> ctx) {
+
+	if (op == OpSubscript)
+		return ctx -> getVarStore () -> getValueForUpdate (evalRef (ctx));
+	else
+		return evaluate (ctx);
+
+}
+
 shared_ptr<CValue> CBinaryOperation::evaluate (shared_ptr<CExecutionContext> ctx) {
 	
 	if (op == OpAssign) {
@@ -542,7 +551,7 @@ shared_ptr<CValue> CBinaryOperation::evaluate (shared_ptr<CExecutionContext> ctx
 	
 }
 
-void CBinaryOperation::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CBinaryOperation::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	stringstream ss;
 	ss << op << ":";
 	hash.update (ss.str());
@@ -566,7 +575,7 @@ shared_ptr<CValue> CArrayExpression::evaluate (shared_ptr<CExecutionContext> ctx
 	
 }
 
-void CArrayExpression::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CArrayExpression::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	for (list<shared_ptr<CExpression>>::iterator it = elems.begin (); it != elems.end (); it++) {
 		hash.update (":elem:");
 		(*it) -> updateHash (ctx, hash);
@@ -588,7 +597,7 @@ shared_ptr<CValue> CDictExpression::evaluate (shared_ptr<CExecutionContext> ctx)
 	
 }
 
-void CDictExpression::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CDictExpression::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	
 	for (map<shared_ptr<CExpression>,shared_ptr<CExpression>>::iterator it = elems.begin (); it != elems.end (); it++) {
 		hash.update (":key:");
@@ -598,11 +607,11 @@ void CDictExpression::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& h
 	}
 }
 
-void CConstantExpression::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CConstantExpression::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	value -> updateHash (hash);
 }
 
-void CVarRefExpression::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CVarRefExpression::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	hash.update (":name:");
 	hash.update (varName);
 	hash.update (":value:");
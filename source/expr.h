@@ -8,7 +8,7 @@ class CExpression;
 
 #include "value.h"
 #include "context.h"
-#include "sha1.h"
+#include "fingerprint.h"
 
 using namespace std;
 
@@ -45,7 +45,7 @@ class CExpression {
 		
 	protected:
 	
-		virtual void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) = 0;
+		virtual void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) = 0;
 
 	public:
 		
@@ -55,9 +55,15 @@ class CExpression {
 			throw ERuntimeError ("Expression is not an lvalue");
 		}
 		
+		// the value of an expression which is about to be subscripted and assigned into
+		
+		virtual shared_ptr<CValue> evalForUpdate (shared_ptr<CExecutionContext> ctx) {
+			return evaluate (ctx);
+		}
+		
 		static shared_ptr<CExpression> parse (CInputParser& parser, int precedenceLevel);
 		
-		void updateHash (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHash (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 	
 };
 
@@ -69,7 +75,7 @@ class CConstantExpression: public CExpression {
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		
 	public:
 		
@@ -91,7 +97,7 @@ class CVarRefExpression: public CExpression {
 		
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		
 	public:
 		
@@ -104,6 +110,10 @@ class CVarRefExpression: public CExpression {
 		shared_ptr<CValueRef> evalRef (shared_ptr<CExecutionContext> ctx) {
 			return ctx -> getVarStore () -> getVarRef (varName);
 		}
+		
+		shared_ptr<CValue> evalForUpdate (shared_ptr<CExecutionContext> ctx) {
+			return ctx -> getVarStore () -> getVarForUpdate (varName);
+		}
 	
 };
 
@@ -117,7 +127,7 @@ class CUnaryOperation: public CExpression {
 		
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		
 	public:
 		
@@ -141,7 +151,7 @@ class CBinaryOperation: public CExpression {
 		
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		
 	public:
 		
@@ -152,6 +162,7 @@ class CBinaryOperation: public CExpression {
 	
 		shared_ptr<CValue> evaluate (shared_ptr<CExecutionContext> ctx);
 		shared_ptr<CValueRef> evalRef (shared_ptr<CExecutionContext> ctx);
+		shared_ptr<CValue> evalForUpdate (shared_ptr<CExecutionContext> ctx);
 
 };
 
@@ -165,7 +176,7 @@ class CTernaryOperation: public CExpression {
 		
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		
 	public:
 		
@@ -186,7 +197,7 @@ class CArrayExpression: public CExpression {
 		
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		
 	public:
 		
@@ -206,7 +217,7 @@ class CDictExpression: public CExpression {
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		
 	public:
 		
@@ -0,0 +1,491 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <ctime>
+
+#include "filecache.h"
+#include "fingerprint.h"
+#include "console.h"
+
+CFileCache fileCache;
+
+CFileCache::CFileCache () {
+
+	generation = 0;
+	records = NULL;
+	names = NULL;
+	entryCount = 0;
+	cacheOpened = false;
+	cacheChanged = false;
+	cacheFileName = getStateDirectory ("") + getPathSeparator () + "filecache";
+
+}
+
+void CFileCache::setNameFromModule (const string& moduleName) {
+
+	lock_guard<mutex> guard (cacheLock);
+
+	if (!cacheOpened)
+		cacheFileName = getStateDirectory (moduleName) + getPathSeparator () + "filecache";
+
+}
+
+void CFileCache::openCache () {
+
+	if (cacheOpened)
+		return;
+
+	cacheOpened = true;
+
+	if (!cacheFile.open (cacheFileName))
+		return;
+
+	const char *data = cacheFile.getData ();
+	size_t size = cacheFile.getSize ();
+
+	CFileCacheHeader header;
+	memset (&header, 0, sizeof (header));
+
+	if (size >= sizeof (header))
+		memcpy (&header, data, sizeof (header));
+
+	// a file of another version or algorithm is simply replaced on save
+
+	if (size >= sizeof (header) && memcmp (header.magic, FILECACHE_MAGIC, sizeof (header.magic)) == 0
+			&& (header.version != FILECACHE_VERSION || header.algorithm != (uint32_t) CFingerprint::getAlgorithm ())) {
+		cacheFile.close ();
+		return;
+	}
+
+	if (size < sizeof (header) || memcmp (header.magic, FILECACHE_MAGIC, sizeof (header.magic)) != 0
+			|| header.recordsOffset > size || header.namesOffset > size
+			|| header.entryCount > (size - header.recordsOffset) / FILECACHE_RECORD_SIZE) {
+		console.error ("lick: " + cacheFileName + " is not a valid file cache, ignoring it");
+		cacheFile.close ();
+		return;
+	}
+
+	records = data + header.recordsOffset;
+	names = data + header.namesOffset;
+	entryCount = header.entryCount;
+	recordsUsed.assign (entryCount, false);
+
+}
+
+void CFileCache::closeCache () {
+
+	cacheFile.close ();
+	records = NULL;
+	names = NULL;
+	entryCount = 0;
+	recordsUsed.clear ();
+	cacheOpened = false;
+
+}
+
+string CFileCache::getRecordName (size_t index) {
+
+	const char *record = records + index * FILECACHE_RECORD_SIZE;
+	uint64_t offset;
+	uint32_t length;
+
+	memcpy (&offset, record, 8);
+	memcpy (&length, record + 8, 4);
+
+	// names come last in the file, anything past its end is a damaged record
+
+	size_t namesSize = cacheFile.getSize () - (names - cacheFile.getData ());
+	if (offset > namesSize || length > namesSize - offset)
+		return string ();
+
+	return string (names + offset, length);
+
+}
+
+void CFileCache::getRecord (size_t index, CFileDigestEntry& entry) {
+
+	const char *record = records + index * FILECACHE_RECORD_SIZE;
+	uint32_t flags;
+
+	memcpy (&flags, record + 12, 4);
+	memcpy (&entry.fileStat.inode, record + 16, 8);
+	memcpy (&entry.fileStat.size, record + 24, 8);
+	memcpy (&entry.fileStat.mtimeNs, record + 32, 8);
+	memcpy (&entry.fileStat.ctimeNs, record + 40, 8);
+
+	entry.hasDigest = (flags & FILECACHE_HAS_DIGEST) != 0;
+	entry.output = (flags & FILECACHE_OUTPUT) != 0;
+
+	if (entry.hasDigest) {
+		CDigest digest;
+		memcpy (digest.bytes, record + 48, DIGEST_SIZE);
+		entry.digest = digest.toHex ();
+	}
+
+}
+
+bool CFileCache::findRecord (const string& absName, size_t& index) {
+
+	size_t low = 0, high = entryCount;
+
+	while (low < high) {
+
+		size_t middle = low + (high - low) / 2;
+		int cmp = getRecordName (middle).compare (absName);
+
+		if (cmp == 0) {
+			index = middle;
+			return true;
+		}
+
+		if (cmp < 0)
+			low = middle + 1;
+		else
+			high = middle;
+
+	}
+
+	return false;
+
+}
+
+bool CFileCache::findEntry (const string& absName, const CFileStat& fileStat, string& digest) {
+
+	map<string,CFileDigestEntry>::iterator it = entries.find (absName);
+
+	if (it != entries.end ()) {
+
+		if (!it -> second.hasDigest || !(it -> second.fileStat == fileStat))
+			return false;
+
+		it -> second.used = true;
+		digest = it -> second.digest;
+		return true;
+
+	}
+
+	size_t index;
+	if (!findRecord (absName, index))
+		return false;
+
+	CFileDigestEntry entry;
+	getRecord (index, entry);
+
+	if (!entry.hasDigest || !(entry.fileStat == fileStat))
+		return false;
+
+	recordsUsed[index] = true;
+	digest = entry.digest;
+	return true;
+
+}
+
+CFileDigestEntry& CFileCache::getEntry (const string& absName) {
+
+	// an entry changed in this run starts from what the file had for it
+
+	map<string,CFileDigestEntry>::iterator it = entries.find (absName);
+	if (it != entries.end ())
+		return it -> second;
+
+	CFileDigestEntry& entry = entries[absName];
+
+	size_t index;
+	if (findRecord (absName, index))
+		getRecord (index, entry);
+
+	return entry;
+
+}
+
+void CFileCache::memoize (const string& absName, uint64_t startGeneration, const CFileMemo& fileMemo) {
+
+	// a stat taken before an invalidation may already be out of date
+
+	if (generation == startGeneration)
+		memo.insert (pair<string,CFileMemo> (absName, fileMemo));
+
+}
+
+bool CFileCache::getStat (const string& absName, CFileStat& fileStat) {
+
+	uint64_t startGeneration;
+
+	{
+		lock_guard<mutex> guard (cacheLock);
+
+		map<string,CFileMemo>::iterator it = memo.find (absName);
+		if (it != memo.end ()) {
+			fileStat = it -> second.fileStat;
+			return it -> second.exists;
+		}
+
+		startGeneration = generation;
+	}
+
+	CFileMemo fileMemo;
+	fileMemo.exists = getFileStat (absName, fileMemo.fileStat);
+
+	lock_guard<mutex> guard (cacheLock);
+	memoize (absName, startGeneration, fileMemo);
+
+	fileStat = fileMemo.fileStat;
+	return fileMemo.exists;
+
+}
+
+bool CFileCache::getDigest (const string& absName, string& digest) {
+
+	CFileStat before;
+	if (!getStat (absName, before) || before.directory)
+		return false;
+
+	uint64_t startGeneration;
+
+	{
+		lock_guard<mutex> guard (cacheLock);
+
+		map<string,CFileMemo>::iterator it = memo.find (absName);
+		if (it != memo.end () && it -> second.hashed) {
+			digest = it -> second.digest;
+			return true;
+		}
+
+		startGeneration = generation;
+		openCache ();
+
+		if (findEntry (absName, before, digest)) {
+			if (it != memo.end ()) {
+				it -> second.hashed = true;
+				it -> second.digest = digest;
+			}
+			return true;
+		}
+	}
+
+	// hashed without the lock, other threads look up other files meanwhile
+
+	ifstream ifs (absName, ios::binary);
+	if (!ifs.is_open ())
+		return false;
+
+	shared_ptr<CFingerprint> hash = CFingerprint::create ();
+	hash -> update (ifs);
+	digest = hash -> final ();
+
+	// a file changing while it is read, or too recently to tell, is not remembered
+
+	CFileStat after;
+	bool unchanged = getFileStat (absName, after) && after == before;
+	bool settled = unchanged && (time_t) (after.mtimeNs / 1000000000) + FILECACHE_RACY_SECONDS < time (NULL);
+
+	lock_guard<mutex> guard (cacheLock);
+
+	if (settled) {
+		CFileDigestEntry& entry = getEntry (absName);
+		entry.fileStat = after;
+		entry.hasDigest = true;
+		entry.digest = digest;
+		entry.used = true;
+		cacheChanged = true;
+	}
+
+	if (unchanged && generation == startGeneration) {
+		CFileMemo& fileMemo = memo[absName];
+		fileMemo.exists = true;
+		fileMemo.fileStat = after;
+		fileMemo.hashed = true;
+		fileMemo.digest = digest;
+	}
+
+	return true;
+
+}
+
+void CFileCache::invalidate (const string& absName) {
+
+	lock_guard<mutex> guard (cacheLock);
+	openCache ();
+
+	generation ++;
+
+	string prefix = absName + getPathSeparator ();
+
+	memo.erase (absName);
+	for (map<string,CFileMemo>::iterator it = memo.lower_bound (prefix); it != memo.end () && it -> first.compare (0, prefix.size (), prefix) == 0; )
+		memo.erase (it++);
+
+	// the digests go, whether a file is an output stays; entries below a directory in the
+	// mapped file go by their stat, which will not match
+
+	size_t index;
+	if (entries.find (absName) != entries.end () || findRecord (absName, index)) {
+		getEntry (absName).hasDigest = false;
+		cacheChanged = true;
+	}
+
+	for (map<string,CFileDigestEntry>::iterator it = entries.lower_bound (prefix); it != entries.end () && it -> first.compare (0, prefix.size (), prefix) == 0; it++)
+		it -> second.hasDigest = false;
+
+}
+
+void CFileCache::markOutput (const string& absName) {
+
+	lock_guard<mutex> guard (cacheLock);
+	openCache ();
+
+	outputs[absName] = true;
+
+	CFileDigestEntry& entry = getEntry (absName);
+	entry.used = true;
+
+	if (!entry.output) {
+		entry.output = true;
+		cacheChanged = true;
+	}
+
+}
+
+bool CFileCache::isOutput (const string& absName) {
+
+	lock_guard<mutex> guard (cacheLock);
+
+	map<string,bool>::iterator it = outputs.find (absName);
+	if (it != outputs.end ())
+		return it -> second;
+
+	openCache ();
+
+	bool output = false;
+	size_t index;
+
+	map<string,CFileDigestEntry>::iterator entry = entries.find (absName);
+	if (entry != entries.end ())
+		output = entry -> second.output;
+	else if (findRecord (absName, index)) {
+		CFileDigestEntry record;
+		getRecord (index, record);
+		output = record.output;
+		if (output)
+			recordsUsed[index] = true;
+	}
+
+	outputs[absName] = output;
+	return output;
+
+}
+
+void CFileCache::invalidateAll () {
+
+	lock_guard<mutex> guard (cacheLock);
+
+	generation ++;
+	memo.clear ();
+
+}
+
+void CFileCache::save () {
+
+	lock_guard<mutex> guard (cacheLock);
+
+	if (!cacheChanged)
+		return;
+
+	// entries of the file merged with the ones found in this run, which take precedence
+
+	map<string,CFileDigestEntry> all;
+
+	for (size_t i = 0; i < entryCount; i++) {
+
+		string name = getRecordName (i);
+		if (name.empty () || entries.find (name) != entries.end ())
+			continue;
+
+		CFileDigestEntry& entry = all[name];
+		getRecord (i, entry);
+		entry.used = recordsUsed[i];
+
+	}
+
+	for (map<string,CFileDigestEntry>::iterator it = entries.begin (); it != entries.end (); it++)
+		all[it -> first] = it -> second;
+
+	size_t usedCount = 0;
+	for (map<string,CFileDigestEntry>::iterator it = all.begin (); it != all.end (); it++) {
+		if (it -> second.used)
+			usedCount ++;
+	}
+
+	size_t unusedRoom = usedCount < FILECACHE_MAX_ENTRIES ? FILECACHE_MAX_ENTRIES - usedCount : 0;
+
+	string recordData, nameData;
+	uint32_t count = 0;
+
+	for (map<string,CFileDigestEntry>::iterator it = all.begin (); it != all.end (); it++) {
+
+		if (!it -> second.hasDigest && !it -> second.output)
+			continue;
+
+		if (!it -> second.used) {
+			if (unusedRoom == 0)
+				continue;
+			unusedRoom --;
+		}
+
+		CDigest digest;
+		memset (digest.bytes, 0, DIGEST_SIZE);
+
+		uint32_t flags = it -> second.output ? FILECACHE_OUTPUT : 0;
+		if (it -> second.hasDigest && CDigest::fromHex (it -> second.digest, digest))
+			flags |= FILECACHE_HAS_DIGEST;
+
+		char record[FILECACHE_RECORD_SIZE];
+		memset (record, 0, sizeof (record));
+
+		uint64_t offset = nameData.size ();
+		uint32_t length = it -> first.size ();
+		const CFileStat& fileStat = it -> second.fileStat;
+
+		memcpy (record, &offset, 8);
+		memcpy (record + 8, &length, 4);
+		memcpy (record + 12, &flags, 4);
+		memcpy (record + 16, &fileStat.inode, 8);
+		memcpy (record + 24, &fileStat.size, 8);
+		memcpy (record + 32, &fileStat.mtimeNs, 8);
+		memcpy (record + 40, &fileStat.ctimeNs, 8);
+		memcpy (record + 48, digest.bytes, DIGEST_SIZE);
+
+		recordData.append (record, sizeof (record));
+		nameData += it -> first;
+		count ++;
+
+	}
+
+	CFileCacheHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, FILECACHE_MAGIC, sizeof (header.magic));
+	header.version = FILECACHE_VERSION;
+	header.entryCount = count;
+	header.algorithm = CFingerprint::getAlgorithm ();
+	header.recordsOffset = sizeof (header);
+	header.namesOffset = header.recordsOffset + recordData.size ();
+
+	string contents ((const char *) &header, sizeof (header));
+	contents += recordData;
+	contents += nameData;
+
+	// a mapped file cannot be replaced on windows
+
+	closeCache ();
+	entries.clear ();
+
+	size_t lastPos = cacheFileName.find_last_of (getPathSeparator ());
+	if (lastPos != string::npos)
+		makeDirs (cacheFileName.substr (0, lastPos));
+
+	if (!writeFileAtomically (cacheFileName, contents))
+		console.error ("lick: failed to save " + cacheFileName);
+
+	cacheChanged = false;
+
+}
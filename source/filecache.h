@@ -0,0 +1,169 @@
+#ifndef __FILECACHE_H__
+#define __FILECACHE_H__
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+
+#include "sys_funcs.h"
+#include "hashstore.h"
+
+using namespace std;
+
+/*
+	What a run knows about one file: its stat, taken at most once until something may have
+	changed the file, and its content digest once computed.
+*/
+
+class CFileMemo {
+
+	public:
+
+		bool exists;
+		CFileStat fileStat;
+		bool hashed;
+		string digest;
+
+		CFileMemo () {
+			exists = false;
+			hashed = false;
+		}
+
+};
+
+/*
+	A file remembered from earlier runs: its digest, valid while the stat tuple is unchanged,
+	and whether a depends block declares it as an output.
+*/
+
+class CFileDigestEntry {
+
+	public:
+
+		CFileStat fileStat;
+		bool hasDigest;
+		string digest;
+		bool output;
+		bool used;
+
+		CFileDigestEntry () {
+			hasDigest = false;
+			output = false;
+			used = false;
+		}
+
+};
+
+/*
+	.lick/filecache layout, native byte order, it is a local cache:
+
+		header      see CFileCacheHeader
+		records     entryCount x 72 bytes { uint64 name offset, uint32 name length, uint32 flags,
+		            uint64 inode, uint64 size, uint64 mtime ns, uint64 ctime ns, 20-byte digest, 4 reserved }
+		names       bytes, records point into them
+
+	Records are sorted by absolute file name, so a lookup is a binary search in the mapped
+	file and startup does not depend on the number of files. algorithm is the
+	FingerprintAlgorithm of the digests; a file of another algorithm or version is ignored.
+*/
+
+#define FILECACHE_MAGIC "LICKFC\r\n"
+#define FILECACHE_VERSION 3
+#define FILECACHE_RECORD_SIZE 72
+
+#define FILECACHE_HAS_DIGEST 1
+#define FILECACHE_OUTPUT 2
+
+struct CFileCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t algorithm;
+	uint32_t reserved;
+	uint64_t recordsOffset;
+	uint64_t namesOffset;
+};
+
+/*
+	Stat and content digest of the files depends looks at. Within a run every file is
+	stat'd once: the result is remembered until lick itself may have changed the file,
+	which writefile, copy and delete report for their paths, and run, pipe and wait for
+	everything. Across runs, the content digests kept in .lick/filecache let the content
+	fingerprint read a file only when its stat tuple (inode, size, mtime and ctime in
+	nanoseconds) has changed since it was hashed. A file modified within
+	FILECACHE_RACY_SECONDS of being hashed is not remembered, since a later change in the
+	same timestamp tick would go unnoticed. Entries of files not looked at by this run are
+	kept only up to FILECACHE_MAX_ENTRIES in total. The file also remembers which files are
+	declared outputs of depends blocks, as their fingerprint is always by contents. Safe to
+	use from any thread.
+*/
+
+#define FILECACHE_RACY_SECONDS 2
+#define FILECACHE_MAX_ENTRIES 100000
+
+class CFileCache {
+
+	private:
+
+		mutex cacheLock;
+
+		map<string,CFileMemo> memo;
+		uint64_t generation;
+
+		CMappedFile cacheFile;
+		const char *records;
+		const char *names;
+		size_t entryCount;
+		vector<bool> recordsUsed;
+
+		map<string,CFileDigestEntry> entries;
+		map<string,bool> outputs;
+
+		string cacheFileName;
+		bool cacheOpened;
+		bool cacheChanged;
+
+		void openCache ();
+		void closeCache ();
+
+		string getRecordName (size_t index);
+		void getRecord (size_t index, CFileDigestEntry& entry);
+		bool findRecord (const string& absName, size_t& index);
+		bool findEntry (const string& absName, const CFileStat& fileStat, string& digest);
+		CFileDigestEntry& getEntry (const string& absName);
+
+		void memoize (const string& absName, uint64_t startGeneration, const CFileMemo& fileMemo);
+
+	public:
+
+		CFileCache ();
+
+		void setNameFromModule (const string& moduleName);
+
+		// stat of absName, or false if it does not exist
+
+		bool getStat (const string& absName, CFileStat& fileStat);
+
+		// digest of the contents of absName, or false if it cannot be read
+
+		bool getDigest (const string& absName, string& digest);
+
+		// declared outputs are fingerprinted by their contents, see CDependsStatement
+
+		void markOutput (const string& absName);
+		bool isOutput (const string& absName);
+
+		// absName, or anything below it, may have changed
+
+		void invalidate (const string& absName);
+		void invalidateAll ();
+
+		void save ();
+
+};
+
+extern CFileCache fileCache;
+
+#endif /* __FILECACHE_H__ */
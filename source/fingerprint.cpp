@@ -0,0 +1,87 @@
+#include <stdexcept>
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+
+#include "fingerprint.h"
+
+FingerprintAlgorithm CFingerprint::algorithm = FingerprintXXH3;
+
+void CFingerprint::update (istream& is) {
+
+	char buffer[65536];
+
+	while (is) {
+		is.read (buffer, sizeof (buffer));
+		if (is.gcount () > 0)
+			update (buffer, is.gcount ());
+	}
+
+}
+
+shared_ptr<CFingerprint> CFingerprint::create () {
+
+	if (algorithm == FingerprintSHA1)
+		return shared_ptr<CFingerprint> (new CSHA1Fingerprint ());
+
+	return shared_ptr<CFingerprint> (new CXXH3Fingerprint ());
+
+}
+
+string CFingerprint::getAlgorithmName (FingerprintAlgorithm algorithm) {
+	return algorithm == FingerprintSHA1 ? "sha1" : "xxh3";
+}
+
+bool CFingerprint::parseAlgorithm (const string& name, FingerprintAlgorithm& algorithm) {
+
+	if (name == "sha1")
+		algorithm = FingerprintSHA1;
+	else if (name == "xxh3")
+		algorithm = FingerprintXXH3;
+	else
+		return false;
+
+	return true;
+
+}
+
+CXXH3Fingerprint::CXXH3Fingerprint () {
+
+	// the state wants 64-byte alignment, which new does not promise before C++17
+
+	state = XXH3_createState ();
+	if (state == NULL)
+		throw runtime_error ("Out of memory");
+
+	XXH3_128bits_reset ((XXH3_state_t *) state);
+
+}
+
+CXXH3Fingerprint::~CXXH3Fingerprint () {
+	XXH3_freeState ((XXH3_state_t *) state);
+}
+
+void CXXH3Fingerprint::update (const void *data, size_t length) {
+	XXH3_128bits_update ((XXH3_state_t *) state, data, length);
+}
+
+string CXXH3Fingerprint::final () {
+
+	XXH128_hash_t hash = XXH3_128bits_digest ((XXH3_state_t *) state);
+
+	XXH128_canonical_t canonical;
+	XXH128_canonicalFromHash (&canonical, hash);
+
+	// formatted by hand, a stream took longer than hashing a short fingerprint
+
+	static const char digits[] = "0123456789abcdef";
+	string result (FINGERPRINT_SIZE * 2, '0');
+
+	for (size_t i = 0; i < sizeof (canonical.digest) && i < FINGERPRINT_SIZE; i++) {
+		result[i * 2] = digits[canonical.digest[i] >> 4];
+		result[i * 2 + 1] = digits[canonical.digest[i] & 15];
+	}
+
+	return result;
+
+}
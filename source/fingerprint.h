@@ -0,0 +1,107 @@
+#ifndef __FINGERPRINT_H__
+#define __FINGERPRINT_H__
+
+#include <string>
+#include <iostream>
+#include <memory>
+
+#include "sha1.h"
+
+using namespace std;
+
+/*
+	Hash behind depends fingerprints, file digests and duration history keys. Every digest
+	is FINGERPRINT_SIZE bytes, returned by final () as hex; shorter hashes are padded with
+	zeroes, so the hash store keeps one digest size whatever the algorithm. Stores record
+	the algorithm they were written with and ignore digests of another one.
+
+	FingerprintXXH3 (XXH3-128, vendored in xxhash.h) is the default: it takes any number of
+	short updates without copying them, and uses SSE2 / AVX2 / NEON where available.
+	FingerprintSHA1 keeps the digests of stores written before it, chosen with lick --hash sha1.
+*/
+
+#define FINGERPRINT_SIZE 20
+
+enum FingerprintAlgorithm {
+	FingerprintSHA1 = 0,
+	FingerprintXXH3 = 1
+};
+
+class CFingerprint {
+
+	private:
+
+		static FingerprintAlgorithm algorithm;
+
+	public:
+
+		virtual ~CFingerprint () { }
+
+		virtual void update (const void *data, size_t length) = 0;
+		virtual string final () = 0;
+
+		void update (const string& s) {
+			update (s.data (), s.length ());
+		}
+
+		void update (istream& is);
+
+		// a new hash of the selected algorithm
+
+		static shared_ptr<CFingerprint> create ();
+
+		static FingerprintAlgorithm getAlgorithm () {
+			return algorithm;
+		}
+
+		static void setAlgorithm (FingerprintAlgorithm newAlgorithm) {
+			algorithm = newAlgorithm;
+		}
+
+		static string getAlgorithmName (FingerprintAlgorithm algorithm);
+		static bool parseAlgorithm (const string& name, FingerprintAlgorithm& algorithm);
+
+};
+
+class CSHA1Fingerprint: public CFingerprint {
+
+	private:
+
+		SHA1 hash;
+
+	public:
+
+		using CFingerprint::update;
+
+		void update (const void *data, size_t length) {
+			hash.update (string ((const char *) data, length));
+		}
+
+		string final () {
+			return hash.final ();
+		}
+
+};
+
+class CXXH3Fingerprint: public CFingerprint {
+
+	private:
+
+		void *state;
+
+		CXXH3Fingerprint (const CXXH3Fingerprint&);
+		CXXH3Fingerprint& operator= (const CXXH3Fingerprint&);
+
+	public:
+
+		using CFingerprint::update;
+
+		CXXH3Fingerprint ();
+		~CXXH3Fingerprint ();
+
+		void update (const void *data, size_t length);
+		string final ();
+
+};
+
+#endif /* __FINGERPRINT_H__ */
@@ -7,6 +7,9 @@
 #include "module.h"
 #include "sys_funcs.h"
 #include "funcs.h"
+#include "jobs.h"
+#include "threads.h"
+#include "filecache.h"
 
 enum BuiltinFunc {
 
@@ -42,7 +45,13 @@ enum BuiltinFunc {
 	funcHex,
 	funcDelete,
 	funcFilename,
-	funcCopy
+	funcCopy,
+	funcSpawn,
+	funcWait,
+	funcWaitAny,
+	funcLickAll,
+	funcPMap,
+	funcPipe
 	
 };
 
@@ -82,6 +91,12 @@ map<string, BuiltinFunc> initBuiltinFuncs () {
 	result["hex"] = funcHex ;
 	result["delete"] = funcDelete ;
 	result["copy"] = funcCopy ;
+	result["spawn"] = funcSpawn ;
+	result["wait"] = funcWait ;
+	result["wait_any"] = funcWaitAny ;
+	result["lick_all"] = funcLickAll ;
+	result["pmap"] = funcPMap ;
+	result["pipe"] = funcPipe ;
 	
 	return result;
 }
@@ -195,6 +210,24 @@ shared_ptr<CFunctionCall> CFunctionCall::getBuiltinFunction (const string& name,
 		case funcCopy:
 			return shared_ptr<CFunctionCall> (new CFuncCopy (args));
 
+		case funcSpawn:
+			return shared_ptr<CFunctionCall> (new CFuncSpawn (args));
+
+		case funcWait:
+			return shared_ptr<CFunctionCall> (new CFuncWait (args));
+
+		case funcWaitAny:
+			return shared_ptr<CFunctionCall> (new CFuncWaitAny (args));
+
+		case funcLickAll:
+			return shared_ptr<CFunctionCall> (new CFuncLickAll (args));
+
+		case funcPMap:
+			return shared_ptr<CFunctionCall> (new CFuncPMap (args));
+
+		case funcPipe:
+			return shared_ptr<CFunctionCall> (new CFuncPipe (args));
+
 		default:
 			return shared_ptr<CFunctionCall> ();
 		
@@ -219,7 +252,7 @@ shared_ptr<CValue> CUserFunctionCall::evaluate (shared_ptr<CExecutionContext> ct
 	
 }
 
-void CFunctionCall::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CFunctionCall::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 
 	for (vector<shared_ptr<CExpression>>::iterator it = args.begin (); it != args.end (); it++) {
 		hash.update (":arg:");
@@ -228,7 +261,7 @@ void CFunctionCall::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& has
 	
 }
 
-void CUserFunctionCall::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CUserFunctionCall::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	
 	hash.update (":name:");
 	hash.update (userFuncName);
@@ -394,6 +427,8 @@ shared_ptr<CValue> CFuncWriteFile::evaluate (shared_ptr<CExecutionContext> ctx)
 	ofs << buffer.rdbuf ();
 	ofs.close ();
 	
+	fileCache.invalidate (getAbsolutePath (makeSysSeparators (fname)));
+	
 	return shared_ptr<CValue> (new CVoidValue ());
 	
 }
@@ -433,46 +468,49 @@ shared_ptr<CValue> CFuncReplace::evaluate (shared_ptr<CExecutionContext> ctx) {
 
 }
 
-shared_ptr<CValue> CFuncRun::evaluate (shared_ptr<CExecutionContext> ctx) {
+void CFuncCommand::collectParams (shared_ptr<CExecutionContext> ctx, list<string>& params) {
 
-	list<string> params;
-	
-	for (vector<shared_ptr<CExpression>>::const_iterator it = args.begin (); it != args.end (); it ++) {
+	for (vector<shared_ptr<CExpression>>::const_iterator it = args.begin (); it != args.end (); it ++)
+		appendParams ((*it) -> evaluate (ctx), params);
 	
-		shared_ptr<CValue> value = (*it) -> evaluate (ctx);
-		if (value -> getType () == ValueArray) {
-			for (int i = 0; i < value -> getLength (); i++) {
-				shared_ptr<CValue> elem = value -> subscript (i);
-				string s = elem -> asString ();
-				if (!s.empty ())
-					params.push_back (s);
-			}
-		} else {
-			string s = value -> asString ();
-			if (!s.empty ()) {
-			
-				size_t pos = 0;
-				while (pos < s.length ()) {
-					size_t nonSpace = s.find_first_not_of (" \t", pos);
-					if (nonSpace == string::npos)
-						break;
+}
+
+void CFuncCommand::appendParams (shared_ptr<CValue> value, list<string>& params) {
+
+	if (value -> getType () == ValueArray) {
+		for (int i = 0; i < value -> getLength (); i++) {
+			shared_ptr<CValue> elem = value -> subscript (i);
+			string s = elem -> asString ();
+			if (!s.empty ())
+				params.push_back (s);
+		}
+	} else {
+		string s = value -> asString ();
+		if (!s.empty ()) {
+		
+			size_t pos = 0;
+			while (pos < s.length ()) {
+				size_t nonSpace = s.find_first_not_of (" \t", pos);
+				if (nonSpace == string::npos)
+					break;
+				
+				pos = nonSpace;
+				size_t nextSpace = s.find_first_of (" \t", pos);
+				if (nextSpace == string::npos)
+					nextSpace = s.length ();
 					
-					pos = nonSpace;
-					size_t nextSpace = s.find_first_of (" \t", pos);
-					if (nextSpace == string::npos)
-						nextSpace = s.length ();
-						
-					string p = s.substr (pos, nextSpace - pos);
-					params.push_back (p);
-
-					pos = nextSpace;
-				}
+				string p = s.substr (pos, nextSpace - pos);
+				params.push_back (p);
+
+				pos = nextSpace;
 			}
 		}
-	
 	}
 	
-	map<string,string> envmap;
+}
+
+bool CFuncCommand::collectEnvironment (shared_ptr<CExecutionContext> ctx, map<string,string>& envmap) {
+
 	bool hasEnv = false;
 	
 	shared_ptr<CValue> envVar = ctx -> getVarStore () -> getVar ("sys");
@@ -507,10 +545,28 @@ shared_ptr<CValue> CFuncRun::evaluate (shared_ptr<CExecutionContext> ctx) {
 		}
 	}
 	
+	return hasEnv;
+	
+}
+
+shared_ptr<CValue> CFuncRun::evaluate (shared_ptr<CExecutionContext> ctx) {
+
+	list<string> params;
+	collectParams (ctx, params);
+	
+	map<string,string> envmap;
+	bool hasEnv = collectEnvironment (ctx, envmap);
+	
 	string capture_stdout;
 	
+	CJobSlot slot;
+	
 	int retCode = runCommand (params, captureOutput ? (&capture_stdout) : NULL, hasEnv ? &envmap : NULL);
 	
+	// the command may have written any file
+	
+	fileCache.invalidateAll ();
+	
 	if (retCode != 0) 
 		throw runtime_error ("Command exec failed");
 		
@@ -518,6 +574,82 @@ shared_ptr<CValue> CFuncRun::evaluate (shared_ptr<CExecutionContext> ctx) {
 
 }
 
+shared_ptr<CValue> CFuncSpawn::evaluate (shared_ptr<CExecutionContext> ctx) {
+
+	list<string> params;
+	collectParams (ctx, params);
+	
+	map<string,string> envmap;
+	bool hasEnv = collectEnvironment (ctx, envmap);
+	
+	int id = jobTable.spawn (params, hasEnv ? &envmap : NULL);
+	
+	return shared_ptr<CValue> (new CIntValue (id));
+
+}
+
+shared_ptr<CValue> CFuncWait::evaluate (shared_ptr<CExecutionContext> ctx) {
+
+	list<int> ids;
+	
+	for (vector<shared_ptr<CExpression>>::iterator it = args.begin (); it != args.end (); it++) {
+	
+		shared_ptr<CValue> arg = (*it) -> evaluate (ctx);
+		
+		if (arg -> getType () == ValueArray) {
+			for (int i = 0; i < arg -> getLength (); i++)
+				ids.push_back (arg -> subscript (i) -> asInt ());
+		} else
+			ids.push_back (arg -> asInt ());
+	
+	}
+	
+	bool succeeded = true;
+	
+	if (args.empty ())
+		succeeded = jobTable.waitAll (true);
+	else {
+		for (list<int>::iterator it = ids.begin (); it != ids.end (); it++) {
+			if (jobTable.wait (*it) != 0)
+				succeeded = false;
+		}
+	}
+	
+	fileCache.invalidateAll ();
+	
+	if (!succeeded)
+		throw runtime_error ("Command exec failed");
+	
+	return shared_ptr<CValue> (new CVoidValue ());
+
+}
+
+shared_ptr<CValue> CFuncWaitAny::evaluate (shared_ptr<CExecutionContext> ctx) {
+
+	set<int> among;
+	
+	if (!args.empty ()) {
+		shared_ptr<CValue> arg = args[0] -> evaluate (ctx);
+		
+		if (arg -> getType () == ValueArray) {
+			for (int i = 0; i < arg -> getLength (); i++)
+				among.insert (arg -> subscript (i) -> asInt ());
+		} else
+			among.insert (arg -> asInt ());
+	}
+	
+	int exitCode = 0;
+	int id = jobTable.waitAny (among, exitCode);
+	
+	fileCache.invalidateAll ();
+	
+	if (exitCode != 0)
+		throw runtime_error ("Command exec failed");
+	
+	return shared_ptr<CValue> (new CIntValue (id));
+
+}
+
 shared_ptr<CValue> CFuncExists::evaluate (shared_ptr<CExecutionContext> ctx) {
 
 	shared_ptr<CValue> arg = args[0] -> evaluate (ctx);;
@@ -739,21 +871,8 @@ shared_ptr<CValue> CFuncMkdir::evaluate (shared_ptr<CExecutionContext> ctx) {
 
 }
 
-shared_ptr<CValue> CFuncLick::evaluate (shared_ptr<CExecutionContext> ctx) {
+static shared_ptr<CValue> lickModule (string path, string target, const list<string>& params) {
 
-	string path = getAbsolutePath (makeSysSeparators (args[0] -> evaluate (ctx) -> asString ()));
-	string target = "";
-	
-	if (args.size() >= 2)
-		target = args[1] -> evaluate (ctx) -> asString ();
-	
-	list<string> params;
-	
-	for (size_t i = 2; i < args.size (); i++) {
-		string param = args[i] -> evaluate (ctx) -> asString ();
-		params.push_back (param);
-	}
-	
 	if (isDirectory (path))
 		path += getPathSeparator () + "lickable";
 	
@@ -794,6 +913,237 @@ shared_ptr<CValue> CFuncLick::evaluate (shared_ptr<CExecutionContext> ctx) {
 
 }
 
+shared_ptr<CValue> CFuncLick::evaluate (shared_ptr<CExecutionContext> ctx) {
+
+	string path = getAbsolutePath (makeSysSeparators (args[0] -> evaluate (ctx) -> asString ()));
+	string target = "";
+	
+	if (args.size() >= 2)
+		target = args[1] -> evaluate (ctx) -> asString ();
+	
+	list<string> params;
+	
+	for (size_t i = 2; i < args.size (); i++) {
+		string param = args[i] -> evaluate (ctx) -> asString ();
+		params.push_back (param);
+	}
+	
+	return lickModule (path, target, params);
+
+}
+
+shared_ptr<CValue> CFuncLickAll::evaluate (shared_ptr<CExecutionContext> ctx) {
+
+	shared_ptr<CValue> dirs = args[0] -> evaluate (ctx);
+	vector<string> paths;
+	
+	if (dirs -> getType () == ValueArray) {
+		for (int i = 0; i < dirs -> getLength (); i++)
+			paths.push_back (getAbsolutePath (makeSysSeparators (dirs -> subscript (i) -> asString ())));
+	} else
+		paths.push_back (getAbsolutePath (makeSysSeparators (dirs -> asString ())));
+	
+	string target = "";
+	
+	if (args.size() >= 2)
+		target = args[1] -> evaluate (ctx) -> asString ();
+	
+	list<string> params;
+	
+	for (size_t i = 2; i < args.size (); i++) {
+		string param = args[i] -> evaluate (ctx) -> asString ();
+		params.push_back (param);
+	}
+	
+	vector<shared_ptr<CValue>> results (paths.size ());
+	vector<string> errors (paths.size ());
+	
+	if (!paths.empty ()) {
+		
+		CWorkerPool pool (min (getJobCount (), (int) paths.size ()));
+		
+		for (size_t i = 0; i < paths.size (); i++) {
+			
+			pool.submit ([&, i] () {
+				
+				// each sub-project starts in its own directory, whatever the others cd() to
+				
+				interpreterLock.setThreadDirectory (isDirectory (paths[i]) ? paths[i] : paths[i].substr (0, paths[i].find_last_of (getAnyPathSeparator ())));
+				CHoldInterpreter interpreter;
+				
+				try {
+					results[i] = lickModule (paths[i], target, params);
+					bool succeeded = jobTable.waitAll (true);
+					fileCache.invalidateAll ();
+					if (!succeeded)
+						throw runtime_error ("Command exec failed");
+				} catch (exception& e) {
+					errors[i] = e.what ();
+				}
+				
+			});
+			
+		}
+		
+		pool.wait ();
+		
+	}
+	
+	CArrayValue *result = new CArrayValue ();
+	
+	for (size_t i = 0; i < paths.size (); i++) {
+		
+		CDictValue *entry = new CDictValue ();
+		
+		entry -> append ("path", shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (new CStringValue (paths[i])))));
+		entry -> append ("ok", shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (new CIntValue (results[i] ? 1 : 0)))));
+		entry -> append ("result", shared_ptr<CValueRef> (new CValueRef (results[i] ? results[i] : shared_ptr<CValue> (new CVoidValue ()))));
+		entry -> append ("error", shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (new CStringValue (errors[i])))));
+		
+		result -> append (shared_ptr<CValueRef> (new CValueRef (shared_ptr<CValue> (entry))));
+		
+	}
+	
+	return shared_ptr<CValue> (result);
+
+}
+
+shared_ptr<CValue> CFuncPipe::evaluate (shared_ptr<CExecutionContext> ctx) {
+
+	vector<list<string>> commands;
+	string inputFile, outputFile;
+	bool appendOutput = false;
+	
+	for (size_t i = 0; i < args.size (); i++) {
+		
+		shared_ptr<CValue> value = args[i] -> evaluate (ctx);
+		
+		if (value -> getType () == ValueDict && i + 1 == args.size ()) {
+			
+			// options: { stdin: "file", stdout: "file", append: true }
+			
+			list<string> keys;
+			value -> getKeys (keys);
+			
+			for (list<string>::iterator it = keys.begin (); it != keys.end (); it++) {
+				if (*it == "stdin")
+					inputFile = makeSysSeparators (value -> subscript (*it) -> asString ());
+				else if (*it == "stdout")
+					outputFile = makeSysSeparators (value -> subscript (*it) -> asString ());
+				else if (*it == "append")
+					appendOutput = value -> subscript (*it) -> asInt () != 0;
+				else
+					throw runtime_error ("pipe(): unknown option " + (*it));
+			}
+			
+			continue;
+			
+		}
+		
+		list<string> params;
+		appendParams (value, params);
+		
+		if (params.empty ())
+			throw runtime_error ("pipe(): empty command");
+		
+		commands.push_back (params);
+		
+	}
+	
+	if (commands.empty ())
+		throw runtime_error ("pipe(): no commands");
+	
+	map<string,string> envmap;
+	bool hasEnv = collectEnvironment (ctx, envmap);
+	
+	// the stages stream into each other, so the pipeline takes one job slot
+	
+	CJobSlot slot;
+	
+	int retCode = runPipeline (commands, hasEnv ? &envmap : NULL, inputFile, outputFile, appendOutput);
+	
+	fileCache.invalidateAll ();
+	
+	if (retCode != 0)
+		throw runtime_error ("Command exec failed");
+	
+	return shared_ptr<CValue> (new CVoidValue ());
+
+}
+
+shared_ptr<CValue> CFuncPMap::evaluate (shared_ptr<CExecutionContext> ctx) {
+
+	shared_ptr<CValue> items = args[0] -> evaluate (ctx);
+	string funcName = args[1] -> evaluate (ctx) -> asString ();
+	
+	// fail early, before anything runs, if the function does not exist
+	
+	ctx -> getBaseContext () -> getFunction (funcName);
+	
+	vector<shared_ptr<CValue>> inputs;
+	if (items -> getType () == ValueArray) {
+		for (int i = 0; i < items -> getLength (); i++)
+			inputs.push_back (items -> subscript (i));
+	} else
+		inputs.push_back (items);
+	
+	// extra arguments are evaluated once and passed after the element
+	
+	vector<shared_ptr<CExpression>> extraArgs;
+	for (size_t i = 2; i < args.size (); i++)
+		extraArgs.push_back (shared_ptr<CExpression> (new CConstantExpression (args[i] -> evaluate (ctx))));
+	
+	vector<shared_ptr<CValue>> results (inputs.size ());
+	
+	if (!inputs.empty ()) {
+		
+		CWorkerPool pool (min (getJobCount (), (int) inputs.size ()));
+		map<thread::id,shared_ptr<CExecutionContext>> workerContexts;
+		size_t nextItem = 0;
+		
+		for (size_t n = 0; n < inputs.size (); n++) {
+			
+			pool.submit ([&] () {
+				
+				CHoldInterpreter interpreter;
+				
+				if (pool.failed ())
+					return;
+				
+				size_t i = nextItem ++;
+				
+				shared_ptr<CExecutionContext>& workerCtx = workerContexts[this_thread::get_id ()];
+				if (!workerCtx)
+					workerCtx = ctx -> enterScope (true);
+				
+				vector<shared_ptr<CExpression>> callArgs;
+				callArgs.push_back (shared_ptr<CExpression> (new CConstantExpression (inputs[i])));
+				callArgs.insert (callArgs.end (), extraArgs.begin (), extraArgs.end ());
+				
+				CUserFunctionCall call (callArgs, funcName);
+				results[i] = call.evaluate (workerCtx);
+				
+				bool succeeded = jobTable.waitAll (true);
+				fileCache.invalidateAll ();
+				if (!succeeded)
+					throw runtime_error ("Command exec failed");
+				
+			});
+			
+		}
+		
+		pool.wait ();
+		
+	}
+	
+	CArrayValue *result = new CArrayValue ();
+	for (size_t i = 0; i < results.size (); i++)
+		result -> append (shared_ptr<CValueRef> (new CValueRef (results[i])));
+	
+	return shared_ptr<CValue> (result);
+
+}
+
 shared_ptr<CValue> CFuncFail::evaluate (shared_ptr<CExecutionContext> ctx) {
 
 	string reason = args[0] -> evaluate (ctx) -> asString ();
@@ -893,11 +1243,19 @@ shared_ptr<CValue> CFuncDelete::evaluate (shared_ptr<CExecutionContext> ctx) {
 		shared_ptr<CValue> arg = (*it) -> evaluate (ctx);
 		
 		if (arg -> getType () == ValueArray) {
-			for (int i = 0; i < arg -> getLength (); i++)
-				deleteFileOrDir (makeSysSeparators (arg -> subscript (i) -> asString ()));
+			for (int i = 0; i < arg -> getLength (); i++) {
+				string fname = makeSysSeparators (arg -> subscript (i) -> asString ());
+				string absName = getAbsolutePath (fname);
+				deleteFileOrDir (fname);
+				fileCache.invalidate (absName);
+			}
 		
-		} else
-			deleteFileOrDir (makeSysSeparators (arg -> asString ()));
+		} else {
+			string fname = makeSysSeparators (arg -> asString ());
+			string absName = getAbsolutePath (fname);
+			deleteFileOrDir (fname);
+			fileCache.invalidate (absName);
+		}
 	
 	}
 	
@@ -922,6 +1280,10 @@ shared_ptr<CValue> CFuncCopy::evaluate (shared_ptr<CExecutionContext> ctx) {
 	
 	}
 	
+	// copy_to is the file or the directory copied into
+	
+	fileCache.invalidate (getAbsolutePath (copy_to));
+	
 	return shared_ptr<CValue> (new CVoidValue ());
 
 }
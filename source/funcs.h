@@ -5,16 +5,18 @@
 #include <vector>
 #include <memory>
 #include <list>
+#include <map>
 
 #include "parser.h"
 #include "expr.h"
+#include "console.h"
 
 class CFunctionCall: public CExpression {
 
 	protected:
 		
 		vector<shared_ptr<CExpression>> args;
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		
 	private:
 		
@@ -36,7 +38,7 @@ class CUserFunctionCall: public CFunctionCall {
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		
 	public:
 		
@@ -96,13 +98,17 @@ class CFuncPrint: public CFunctionCall {
 
 		shared_ptr<CValue> evaluate (shared_ptr<CExecutionContext> ctx) {
 			
+			string text;
+			
 			for (vector<shared_ptr<CExpression>>::iterator it = args.begin (); it != args.end (); it++) {
 				shared_ptr<CValue> arg = (*it) -> evaluate (ctx);
-				cout << arg -> asString ();
+				text += arg -> asString ();
 			}
 			
 			if (addNewLine)
-				cout << endl;
+				text += "\n";
+			
+			console.write (text);
 			
 			return shared_ptr<CValue> (new CVoidValue ());
 		}
@@ -187,7 +193,21 @@ class CFuncReplace: public CFunctionCall {
 		
 };
 
-class CFuncRun: public CFunctionCall {
+class CFuncCommand: public CFunctionCall {
+	
+	protected:
+	
+		void collectParams (shared_ptr<CExecutionContext> ctx, list<string>& params);
+		static void appendParams (shared_ptr<CValue> value, list<string>& params);
+		bool collectEnvironment (shared_ptr<CExecutionContext> ctx, map<string,string>& envmap);
+		
+	public:
+	
+		CFuncCommand (const vector<shared_ptr<CExpression>>& p_args): CFunctionCall (p_args) { }
+		
+};
+
+class CFuncRun: public CFuncCommand {
 	
 	private:
 		
@@ -195,7 +215,7 @@ class CFuncRun: public CFunctionCall {
 	
 	public:
 		
-		CFuncRun (const vector<shared_ptr<CExpression>>& p_args, bool p_captureOutput): CFunctionCall (p_args) {
+		CFuncRun (const vector<shared_ptr<CExpression>>& p_args, bool p_captureOutput): CFuncCommand (p_args) {
 			if (args.size () < 1)
 				throw runtime_error ("run() expects at least 1 parameter");
 			captureOutput = p_captureOutput;
@@ -205,6 +225,42 @@ class CFuncRun: public CFunctionCall {
 		
 };
 
+class CFuncSpawn: public CFuncCommand {
+	
+	public:
+		
+		CFuncSpawn (const vector<shared_ptr<CExpression>>& p_args): CFuncCommand (p_args) {
+			if (args.size () < 1)
+				throw runtime_error ("spawn() expects at least 1 parameter");
+		}
+
+		shared_ptr<CValue> evaluate (shared_ptr<CExecutionContext> ctx);
+		
+};
+
+class CFuncWait: public CFunctionCall {
+	
+	public:
+		
+		CFuncWait (const vector<shared_ptr<CExpression>>& p_args): CFunctionCall (p_args) { }
+
+		shared_ptr<CValue> evaluate (shared_ptr<CExecutionContext> ctx);
+		
+};
+
+class CFuncWaitAny: public CFunctionCall {
+	
+	public:
+		
+		CFuncWaitAny (const vector<shared_ptr<CExpression>>& p_args): CFunctionCall (p_args) {
+			if (args.size () > 1)
+				throw runtime_error ("wait_any() expects at most 1 parameter");
+		}
+
+		shared_ptr<CValue> evaluate (shared_ptr<CExecutionContext> ctx);
+		
+};
+
 class CFuncExists: public CFunctionCall {
 	
 	public:
@@ -365,6 +421,45 @@ class CFuncLick: public CFunctionCall {
 		
 };
 
+class CFuncPipe: public CFuncCommand {
+	
+	public:
+		
+		CFuncPipe (const vector<shared_ptr<CExpression>>& p_args): CFuncCommand (p_args) {
+			if (args.size () < 1)
+				throw runtime_error ("pipe() expects at least 1 parameter");
+		}
+
+		shared_ptr<CValue> evaluate (shared_ptr<CExecutionContext> ctx);
+		
+};
+
+class CFuncPMap: public CFunctionCall {
+	
+	public:
+		
+		CFuncPMap (const vector<shared_ptr<CExpression>>& p_args): CFunctionCall (p_args) {
+			if (args.size () < 2)
+				throw runtime_error ("pmap() expects at least 2 parameters");
+		}
+
+		shared_ptr<CValue> evaluate (shared_ptr<CExecutionContext> ctx);
+		
+};
+
+class CFuncLickAll: public CFunctionCall {
+	
+	public:
+		
+		CFuncLickAll (const vector<shared_ptr<CExpression>>& p_args): CFunctionCall (p_args) {
+			if (args.size () < 1)
+				throw runtime_error ("lick_all() expects at least 1 parameter");
+		}
+
+		shared_ptr<CValue> evaluate (shared_ptr<CExecutionContext> ctx);
+		
+};
+
 class CFuncFail: public CFunctionCall {
 	
 	public:
@@ -1,207 +1,1595 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <random>
+#include <chrono>
+#include <cstddef>
 
 #include "hashstore.h"
 #include "sys_funcs.h"
+#include "threads.h"
+#include "sha1.h"
+#include "console.h"
 
 CHashStore hashStore;
 
-bool CTargetHashStore::containsHash (const string& hash) {
+static int hexValue (char c) {
+
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+
+}
+
+bool CDigest::fromHex (const string& hex, CDigest& digest) {
+
+	if (hex.length () != DIGEST_SIZE * 2)
+		return false;
+
+	for (size_t i = 0; i < DIGEST_SIZE; i++) {
+		int hi = hexValue (hex[i * 2]);
+		int lo = hexValue (hex[i * 2 + 1]);
+		if (hi < 0 || lo < 0)
+			return false;
+		digest.bytes[i] = (unsigned char) ((hi << 4) | lo);
+	}
+
+	return true;
+
+}
+
+string CDigest::toHex () const {
+
+	static const char digits[] = "0123456789abcdef";
+	string result (DIGEST_SIZE * 2, '0');
+
+	for (size_t i = 0; i < DIGEST_SIZE; i++) {
+		result[i * 2] = digits[bytes[i] >> 4];
+		result[i * 2 + 1] = digits[bytes[i] & 0x0f];
+	}
+
+	return result;
+
+}
+
+size_t CDigestSet::findSlot (const CDigest& hash) const {
+
+	uint64_t key;
+	memcpy (&key, hash.bytes, sizeof (key));
+
+	size_t mask = slots.size () - 1;
+	size_t slot = key & mask;
+
+	while (used[slot] && memcmp (slots[slot].bytes, hash.bytes, DIGEST_SIZE) != 0)
+		slot = (slot + 1) & mask;
+
+	return slot;
+
+}
+
+void CDigestSet::grow () {
+
+	vector<CDigest> oldSlots;
+	vector<unsigned char> oldUsed;
+	oldSlots.swap (slots);
+	oldUsed.swap (used);
+
+	size_t capacity = oldSlots.empty () ? 16 : oldSlots.size () * 2;
+	slots.resize (capacity);
+	used.assign (capacity, 0);
+
+	for (size_t i = 0; i < oldSlots.size (); i++) {
+		if (oldUsed[i]) {
+			size_t slot = findSlot (oldSlots[i]);
+			slots[slot] = oldSlots[i];
+			used[slot] = 1;
+		}
+	}
+
+}
+
+bool CDigestSet::insert (const CDigest& hash) {
+
+	if ((count + 1) * 2 > slots.size ())
+		grow ();
+
+	size_t slot = findSlot (hash);
+	if (used[slot])
+		return false;
+
+	slots[slot] = hash;
+	used[slot] = 1;
+	count++;
+
+	return true;
+
+}
+
+bool CDigestSet::contains (const CDigest& hash) const {
+
+	if (count == 0)
+		return false;
+
+	return used[findSlot (hash)] != 0;
+
+}
+
+void CDigestSet::clear () {
+
+	vector<CDigest> ().swap (slots);
+	vector<unsigned char> ().swap (used);
+	count = 0;
+
+}
+
+void CDigestSet::getAll (vector<CDigest>& result) const {
+
+	for (size_t i = 0; i < slots.size (); i++)
+		if (used[i])
+			result.push_back (slots[i]);
+
+}
+
+bool CTargetHashStore::containsHash (const CDigest& hash, bool& recorded) {
 
 	touched = true;
+	recorded = false;
+
+	const CDigest *found = lower_bound (prevRunHashes, prevRunHashes + prevRunCount, hash);
+
+	if (found != prevRunHashes + prevRunCount && memcmp (found -> bytes, hash.bytes, DIGEST_SIZE) == 0) {
+
+		if (prevRunSeen.empty ())
+			prevRunSeen.resize (prevRunCount);
+
+		size_t index = found - prevRunHashes;
+		recorded = !prevRunSeen[index];
+		prevRunSeen[index] = true;
+
+		return true;
+
+	}
+
+	return addedHashes.contains (hash);
+
+}
+
+bool CTargetHashStore::peekHash (const CDigest& hash) {
+
+	if (binary_search (prevRunHashes, prevRunHashes + prevRunCount, hash))
+		return true;
+
+	return addedHashes.contains (hash);
+
+}
+
+bool CTargetHashStore::addHash (const CDigest& hash) {
+
+	bool recorded;
+	if (containsHash (hash, recorded))
+		return recorded;
+
+	return addedHashes.insert (hash);
+
+}
+
+void CTargetHashStore::clear () {
+
+	touched = true;
+	addedHashes.clear ();
+
+	// the previous run no longer counts either
+
+	loadedHashes.clear ();
+	prevRunSeen.clear ();
+	prevRunHashes = NULL;
+	prevRunCount = 0;
+
+}
+
+void CTargetHashStore::setPrevRun (const CDigest *digests, size_t count) {
+	prevRunHashes = digests;
+	prevRunCount = count;
+	prevRunSeen.clear ();
+}
+
+void CTargetHashStore::load (const CDigest& hash) {
+	loadedHashes.push_back (hash);
+}
+
+void CTargetHashStore::finishLoad () {
+
+	sort (loadedHashes.begin (), loadedHashes.end ());
+	loadedHashes.erase (unique (loadedHashes.begin (), loadedHashes.end (), [] (const CDigest& a, const CDigest& b) { return memcmp (a.bytes, b.bytes, DIGEST_SIZE) == 0; }), loadedHashes.end ());
+
+	prevRunHashes = loadedHashes.empty () ? NULL : &loadedHashes[0];
+	prevRunCount = loadedHashes.size ();
+	prevRunSeen.clear ();
+
+}
+
+void CTargetHashStore::replacePrevRun (const set<CDigest>& digests) {
+
+	loadedHashes.assign (digests.begin (), digests.end ());
+
+	prevRunHashes = loadedHashes.empty () ? NULL : &loadedHashes[0];
+	prevRunCount = loadedHashes.size ();
+	prevRunSeen.clear ();
+
+}
+
+void CTargetHashStore::getHashes (vector<CDigest>& result) {
+
+	// a target which ran keeps only the hashes it used; others keep what they had
+
+	if (!touched) {
+		getPrevRunHashes (result);
+		return;
+	}
+
+	result.clear ();
+	result.reserve (addedHashes.size () + (prevRunSeen.empty () ? 0 : prevRunCount));
+
+	for (size_t i = 0; i < prevRunSeen.size (); i++)
+		if (prevRunSeen[i])
+			result.push_back (prevRunHashes[i]);
+
+	// the previous run part is sorted already
+
+	size_t prevRunPart = result.size ();
+	addedHashes.getAll (result);
+	sort (result.begin () + prevRunPart, result.end ());
+	inplace_merge (result.begin (), result.begin () + prevRunPart, result.end ());
+
+}
+
+void CTargetHashStore::getPrevRunHashes (vector<CDigest>& result) {
+	result.assign (prevRunHashes, prevRunHashes + prevRunCount);
+}
+
+void CModuleHashStore::clear () {
+
+	for (map<string,CTargetHashStore>::iterator it = targetHashes.begin (); it != targetHashes.end (); it++)
+		it -> second.clear ();
+
+}
+
+CTargetHashStore *CModuleHashStore::findTarget (const string& target) {
+
+	map<string,CTargetHashStore>::iterator it = targetHashes.find (target);
+	return it == targetHashes.end () ? NULL : &it -> second;
+
+}
+
+CTargetHashStore& CModuleHashStore::getTarget (const string& target) {
+	return targetHashes[target];
+}
+
+map<string,CTargetHashStore>& CModuleHashStore::getHashes () {
+	return targetHashes;
+}
+
+CHashStoreShard::CHashStoreShard (const string& baseName, uint64_t sessionId) {
+
+	this -> baseName = baseName;
+	this -> sessionId = sessionId;
+
+	storeOpened = false;
+	storeChanged = false;
+	journal = NULL;
+	runRecorded = false;
+	sessionRecorded = false;
+	journalLoaded = 0;
+	runCount = 0;
+	storeForeign = false;
+
+}
+
+CHashStoreShard::~CHashStoreShard () {
+	close ();
+}
+
+string CHashStoreShard::getStoreFileName () {
+	return baseName + ".bin";
+}
+
+string CHashStoreShard::getJournalFileName () {
+	return baseName + ".journal";
+}
+
+bool CHashStoreShard::loadBinary (const string& fileName) {
+
+	if (!storeFile.open (fileName))
+		return false;
+
+	const char *data = storeFile.getData ();
+	size_t size = storeFile.getSize ();
+
+	CHashStoreHeader header;
+	memset (&header, 0, sizeof (header));
+
+	// version 1 has no run numbers: a shorter header and 24-byte groups
+
+	size_t headerSize = offsetof (CHashStoreHeader, runCount);
+	if (size >= headerSize)
+		memcpy (&header, data, headerSize);
+
+	if (header.version == HASHSTORE_VERSION) {
+		headerSize = sizeof (header);
+		if (size >= headerSize)
+			memcpy (&header, data, headerSize);
+	}
+
+	size_t groupSize = header.version == 1 ? 24 : 32;
+
+	if (size < headerSize || memcmp (header.magic, HASHSTORE_MAGIC, sizeof (header.magic)) != 0
+			|| (header.version != 1 && header.version != HASHSTORE_VERSION)
+			|| header.namesOffset > size || header.groupsOffset > size || header.digestsOffset > size
+			|| header.groupCount > (size - header.groupsOffset) / groupSize
+			|| header.digestCount > (size - header.digestsOffset) / DIGEST_SIZE) {
+		console.error ("lick: " + fileName + " is not a valid hash store, ignoring it");
+		storeFile.close ();
+		return false;
+	}
+
+	runCount = header.runCount;
+
+	storeForeign = header.algorithm != (uint32_t) CFingerprint::getAlgorithm ();
+
+	if (storeForeign) {
+		console.error ("lick: " + fileName + " holds " + CFingerprint::getAlgorithmName ((FingerprintAlgorithm) header.algorithm)
+				+ " hashes, " + CFingerprint::getAlgorithmName (CFingerprint::getAlgorithm ()) + " is used now, starting afresh");
+		storeFile.close ();
+		return true;
+	}
+
+	vector<string> names;
+	size_t pos = header.namesOffset;
+
+	for (uint32_t i = 0; i < header.nameCount; i++) {
+
+		uint32_t length;
+		if (pos + sizeof (length) > size)
+			break;
+
+		memcpy (&length, data + pos, sizeof (length));
+		pos += sizeof (length);
+
+		if (length > size - pos)
+			break;
+
+		names.push_back (string (data + pos, length));
+		pos += length;
+
+	}
+
+	const CDigest *digests = (const CDigest *) (data + header.digestsOffset);
+
+	for (uint32_t i = 0; i < header.groupCount; i++) {
+
+		const char *group = data + header.groupsOffset + i * groupSize;
+		uint32_t moduleIndex, targetIndex;
+		uint64_t first, count, lastUsedRun = 0;
+
+		memcpy (&moduleIndex, group, 4);
+		memcpy (&targetIndex, group + 4, 4);
+		memcpy (&first, group + 8, 8);
+		memcpy (&count, group + 16, 8);
+		if (groupSize > 24)
+			memcpy (&lastUsedRun, group + 24, 8);
+
+		if (moduleIndex >= names.size () || targetIndex >= names.size () || first > header.digestCount || count > header.digestCount - first)
+			continue;
+
+		CTargetHashStore& targetStore = moduleHashes[names[moduleIndex]].getTarget (names[targetIndex]);
+		targetStore.setPrevRun (digests + first, count);
+		targetStore.setLastUsedRun (lastUsedRun);
+
+	}
+
+#ifdef _MSC_VER
+
+	// a mapped file cannot be replaced on windows, so keep a private copy instead
+
+	for (map<string,CModuleHashStore>::iterator it = moduleHashes.begin (); it != moduleHashes.end (); it++) {
+		map<string,CTargetHashStore>& targetHashes = it -> second.getHashes ();
+		for (map<string,CTargetHashStore>::iterator i1 = targetHashes.begin (); i1 != targetHashes.end (); i1++) {
+			vector<CDigest> mapped;
+			i1 -> second.getHashes (mapped);
+			for (size_t i = 0; i < mapped.size (); i++)
+				i1 -> second.load (mapped[i]);
+			i1 -> second.finishLoad ();
+		}
+	}
+
+	storeFile.close ();
+
+#endif
+
+	return true;
+
+}
+
+// one "module|target|hex" line of the text format, false if it is not one
+
+static bool parseTextLine (string line, string& moduleName, string& targetName, CDigest& hash) {
+
+	if (!line.empty () && line[line.length () - 1] == '\r')
+		line.erase (line.length () - 1);
+
+	size_t pos = line.find_first_of ("|");
+	if (pos == string::npos || pos == 0)
+		return false;
+
+	size_t pos1 = line.find_first_of ("|", pos+1);
+	if (pos1 == string::npos)
+		return false;
+
+	moduleName = line.substr (0, pos);
+	targetName = line.substr (pos+1, pos1 - (pos + 1));
+
+	return CDigest::fromHex (line.substr (pos1+1), hash);
+
+}
+
+bool CHashStoreShard::loadText (const string& fileName) {
+
+	ifstream ifs;
+	ifs.open (fileName);
+	if (!ifs.is_open ())
+		return false;
+
+	string line;
+
+	while (getline (ifs, line)) {
+
+		string moduleName, targetName;
+		CDigest hash;
+
+		if (parseTextLine (line, moduleName, targetName, hash))
+			moduleHashes[moduleName].getTarget (targetName).load (hash);
+
+	}
+
+	ifs.close ();
+
+	for (map<string,CModuleHashStore>::iterator it = moduleHashes.begin (); it != moduleHashes.end (); it++) {
+		map<string,CTargetHashStore>& targetHashes = it -> second.getHashes ();
+		for (map<string,CTargetHashStore>::iterator i1 = targetHashes.begin (); i1 != targetHashes.end (); i1++)
+			i1 -> second.finishLoad ();
+	}
+
+	return true;
+
+}
+
+static bool readJournalName (const string& data, size_t& pos, string& name) {
+
+	uint32_t length;
+	if (pos + sizeof (length) > data.length ())
+		return false;
+
+	memcpy (&length, data.data () + pos, sizeof (length));
+	pos += sizeof (length);
+
+	if (length > data.length () - pos)
+		return false;
+
+	name = data.substr (pos, length);
+	pos += length;
+	return true;
+
+}
+
+static void appendJournalName (string& record, const string& name) {
+	uint32_t length = name.length ();
+	record.append ((const char *) &length, sizeof (length));
+	record.append (name);
+}
+
+void CHashStoreShard::replayJournal (const string& fileName, CReplayState& state) {
+
+	state.journalLoaded = 0;
+
+	ifstream ifs (fileName, ios::binary);
+	if (!ifs.is_open ())
+		return;
+
+	string data ((istreambuf_iterator<char> (ifs)), istreambuf_iterator<char> ());
+	ifs.close ();
+
+	// a target first seen in the journal starts from what the store has for it
+
+	auto getReplayTarget = [&] (const string& module, const string& target) -> CReplayTarget& {
+
+		map<string,CReplayTarget>& targets = state.targets[module];
+		map<string,CReplayTarget>::iterator it = targets.find (target);
+		if (it != targets.end ())
+			return it -> second;
+
+		CReplayTarget& result = targets[target];
+		result.anyStarted = false;
+		result.lastStarted = 0;
+		result.lastUsedRun = 0;
+
+		CTargetHashStore *targetStore = moduleHashes[module].findTarget (target);
+		if (targetStore != NULL) {
+			vector<CDigest> prevRun;
+			targetStore -> getPrevRunHashes (prevRun);
+			result.hashes.insert (prevRun.begin (), prevRun.end ());
+			result.lastUsedRun = targetStore -> getLastUsedRun ();
+		}
+
+		return result;
+
+	};
+
+	size_t pos = 0;
+	size_t valid = 0;
+
+	while (pos < data.length ()) {
+
+		// positions count on from the journals replayed before, as .old precedes the journal
+
+		uint64_t position = state.journalSize + pos;
+
+		char op = data[pos++];
+		uint64_t session;
+		string module, target;
+		CDigest hash;
+
+		if (pos + sizeof (session) > data.length ())
+			break;
+
+		memcpy (&session, data.data () + pos, sizeof (session));
+		pos += sizeof (session);
+
+		map<uint64_t,CReplaySpan>::iterator span = state.sessionSpans.find (session);
+		if (span == state.sessionSpans.end ()) {
+			CReplaySpan newSpan = { position, position };
+			span = state.sessionSpans.insert (pair<uint64_t,CReplaySpan> (session, newSpan)).first;
+		}
+
+		if (op == 'S') {
+
+			// a session's start is where it loaded the journal, which is the one it is in
+
+			uint64_t loaded;
+			if (pos + sizeof (loaded) > data.length ())
+				break;
+
+			memcpy (&loaded, data.data () + pos, sizeof (loaded));
+			pos += sizeof (loaded);
+
+			span -> second.start = min (span -> second.start, state.journalSize + loaded);
+
+		} else if (op == 'E')
+			span -> second.end = position;
+
+		if (op == 'S' || op == 'E') {
+			valid = pos;
+			continue;
+		}
+
+		span -> second.end = max (span -> second.end, position);
+
+		if (!readJournalName (data, pos, module))
+			break;
+
+		// sessions from before run numbers count as the latest run
+
+		map<uint64_t,uint64_t>::iterator run = state.sessionRuns.find (session);
+		uint64_t sessionRun = run != state.sessionRuns.end () ? run -> second : runCount;
+
+		if (op == 'R') {
+
+			runCount++;
+			state.journalRuns++;
+			state.sessionRuns[session] = runCount;
+
+			string algorithm = module.empty () ? CFingerprint::getAlgorithmName (FingerprintSHA1) : module;
+			if (algorithm != CFingerprint::getAlgorithmName (CFingerprint::getAlgorithm ()))
+				state.foreignSessions.insert (session);
+
+		} else if (op == 'C') {
+
+			map<string,CTargetHashStore>& stored = moduleHashes[module].getHashes ();
+			for (map<string,CTargetHashStore>::iterator it = stored.begin (); it != stored.end (); it++)
+				getReplayTarget (module, it -> first);
+
+			map<string,CReplayTarget>& targets = state.targets[module];
+			for (map<string,CReplayTarget>::iterator it = targets.begin (); it != targets.end (); it++) {
+				it -> second.hashes.clear ();
+				it -> second.sessions.clear ();
+				it -> second.anyStarted = false;
+				it -> second.lastUsedRun = max (it -> second.lastUsedRun, sessionRun);
+			}
+
+		} else if (op == 'T' || op == 'U' || op == 'A') {
+
+			if (!readJournalName (data, pos, target))
+				break;
+
+			if (op != 'T') {
+				if (pos + DIGEST_SIZE > data.length ())
+					break;
+				memcpy (hash.bytes, data.data () + pos, DIGEST_SIZE);
+				pos += DIGEST_SIZE;
+			}
+
+			if (state.foreignSessions.find (session) != state.foreignSessions.end ()) {
+				valid = pos;
+				continue;
+			}
+
+			CReplayTarget& replayTarget = getReplayTarget (module, target);
+			CReplaySession& replaySession = replayTarget.sessions[session];
+
+			replayTarget.lastUsedRun = max (replayTarget.lastUsedRun, sessionRun);
+
+			if (op == 'T') {
+				replaySession.hashes.clear ();
+				replayTarget.anyStarted = true;
+				replayTarget.lastStarted = session;
+			} else
+				replaySession.hashes.insert (hash);
+
+		} else
+			break;
+
+		valid = pos;
+
+	}
+
+	if (valid < data.length ()) {
+
+		// torn or damaged tail, most likely from a killed run; later records must not follow it
+
+		stringstream ss;
+		ss << "lick: dropping " << (data.length () - valid) << " damaged bytes at the end of " << fileName;
+		console.error (ss.str ());
+		if (!writeFileAtomically (fileName, data.substr (0, valid)))
+			deleteFileOrDir (fileName);
+
+	}
+
+	state.journalSize += valid;
+	state.journalLoaded = valid;
+
+}
+
+void CHashStoreShard::applyJournal (CReplayState& state) {
+
+	for (map<string,map<string,CReplayTarget>>::iterator it = state.targets.begin (); it != state.targets.end (); it++) {
+		for (map<string,CReplayTarget>::iterator i1 = it -> second.begin (); i1 != it -> second.end (); i1++) {
+
+			CReplayTarget& replayTarget = i1 -> second;
+			set<CDigest> result;
+
+			// the latest run of a target decides, together with every session which was still
+			// live when it loaded the journal; without a run since the store was written,
+			// everything recorded is added to it
+
+			uint64_t latestStart = 0;
+			if (replayTarget.anyStarted)
+				latestStart = state.sessionSpans[replayTarget.lastStarted].start;
+			else
+				result = replayTarget.hashes;
+
+			for (map<uint64_t,CReplaySession>::iterator i2 = replayTarget.sessions.begin (); i2 != replayTarget.sessions.end (); i2++)
+				if (!replayTarget.anyStarted || i2 -> first == replayTarget.lastStarted || state.sessionSpans[i2 -> first].end > latestStart)
+					result.insert (i2 -> second.hashes.begin (), i2 -> second.hashes.end ());
+
+			CTargetHashStore& targetStore = moduleHashes[it -> first].getTarget (i1 -> first);
+			targetStore.replacePrevRun (result);
+			targetStore.setLastUsedRun (replayTarget.lastUsedRun);
+
+		}
+	}
+
+}
+
+void CHashStoreShard::compact () {
+
+	string journalName = getJournalFileName ();
+	string oldJournalName = journalName + ".old";
+
+	// nothing is touched yet, so this is exactly the replayed state
+
+	string contents = buildStore (true, NULL, NULL);
+
+	if (fileExists (oldJournalName) || !fileExists (journalName)) {
+
+		// an earlier compaction did not finish, both journals are part of contents already;
+		// or there is no journal, only a store of another algorithm to replace
+
+		if (writeFileAtomically (getStoreFileName (), contents)) {
+			deleteFileOrDir (oldJournalName);
+			deleteFileOrDir (journalName);
+			journalLoaded = 0;
+		} else
+			console.error ("lick: failed to save " + getStoreFileName ());
+
+		return;
+
+	}
+
+	if (replaceFile (journalName, oldJournalName)) {
+		journalLoaded = 0;
+		compactThread = thread (&CHashStoreShard::writeCompacted, this, move (contents), oldJournalName);
+	}
+
+}
+
+void CHashStoreShard::writeCompacted (string contents, string oldJournalName) {
+
+	// runs without the interpreter: it only touches its own copy of the store
+
+	if (writeFileAtomically (getStoreFileName (), contents))
+		deleteFileOrDir (oldJournalName);
+	else
+		console.error ("lick: failed to save " + getStoreFileName ());
+
+}
+
+void CHashStoreShard::openJournal () {
+
+	sessionRecorded = false;
+
+	journal = openAppendFile (getJournalFileName ());
+	if (journal == NULL)
+		console.error ("lick: failed to open " + getJournalFileName () + ", hashes of this run will not be kept");
+
+}
+
+void CHashStoreShard::closeJournal () {
+
+	if (journal != NULL && sessionRecorded) {
+		string record (1, 'E');
+		record.append ((const char *) &sessionId, sizeof (sessionId));
+		writeJournal (record);
+	}
+
+	if (journal != NULL) {
+		syncFile (journal);
+		fclose (journal);
+		journal = NULL;
+	}
+
+}
+
+void CHashStoreShard::appendJournal (char op, const string& module, const string& target, const CDigest *hash) {
+
+	if (journal == NULL)
+		return;
+
+	string record;
+
+	// the first record of a process counts the run
+
+	if (!runRecorded) {
+		record.append (1, 'R');
+		record.append ((const char *) &sessionId, sizeof (sessionId));
+		appendJournalName (record, CFingerprint::getAlgorithmName (CFingerprint::getAlgorithm ()));
+	}
+
+	// and the first after opening the journal where the session began; until it writes
+	// something, a session cannot matter to any other
+
+	if (!sessionRecorded) {
+		record.append (1, 'S');
+		record.append ((const char *) &sessionId, sizeof (sessionId));
+		record.append ((const char *) &journalLoaded, sizeof (journalLoaded));
+	}
+
+	record.append (1, op);
+	record.append ((const char *) &sessionId, sizeof (sessionId));
+	appendJournalName (record, module);
+	if (op != 'C')
+		appendJournalName (record, target);
+	if (hash != NULL)
+		record.append ((const char *) hash -> bytes, DIGEST_SIZE);
+
+	if (!writeJournal (record))
+		return;
+
+	runRecorded = true;
+	sessionRecorded = true;
+	storeChanged = true;
+
+}
+
+bool CHashStoreShard::writeJournal (const string& record) {
+
+	// one write per record, so records of concurrent processes never interleave;
+	// flushed at once, so a killed lick keeps it; fsync waits for flush ()
+
+	if (fwrite (record.data (), 1, record.length (), journal) != record.length () || fflush (journal) != 0) {
+		console.error ("lick: failed to write " + getJournalFileName () + ", hashes of this run will not be kept");
+		fclose (journal);
+		journal = NULL;
+		return false;
+	}
+
+	return true;
+
+}
+
+void CHashStoreShard::touchTarget (CTargetHashStore& targetStore, const string& module, const string& target) {
+
+	if (!targetStore.isTouched ())
+		appendJournal ('T', module, target, NULL);
+
+}
+
+void CHashStoreShard::open (bool exclusive) {
+
+	if (storeOpened)
+		return;
+
+	storeOpened = true;
+
+	if (!storeFileLock.open (baseName + ".lock"))
+		console.error ("lick: failed to open " + baseName + ".lock, the hash store is not locked");
+
+	// alone: no other lick has the shard open, so it may be rewritten
+
+	bool alone = storeFileLock.lock (true, exclusive);
+	if (!alone)
+		storeFileLock.lock (false, true);
+
+	CReplayState state;
+	loadStore (alone, state);
+
+	// exclusive: the caller takes the shard apart, it stays locked and gets no journal
+
+	if (exclusive)
+		return;
+
+	long storeSize = 0;
+	getFileInfo (getStoreFileName (), &storeSize, NULL);
+
+	// a store of another algorithm is rewritten at once, it is of no use any more
+
+	if (alone && (storeForeign || state.journalSize > (size_t) max ((long) HASHSTORE_JOURNAL_LIMIT, storeSize) || state.journalRuns >= HASHSTORE_COMPACT_RUNS))
+		compact ();
+
+	if (alone)
+		storeFileLock.lock (false, true);
+
+	openJournal ();
+
+}
+
+void CHashStoreShard::loadStore (bool alone, CReplayState& state) {
+
+	string oldJournalName = getJournalFileName () + ".old";
+
+	// the compaction of another lick goes on under its shared lock: when it renames the new
+	// store into place and deletes the old journal while this one loads, what was read may
+	// be the store from before without the journal that belongs to it, so it is read again
+
+	while (true) {
+
+		bool compacting = fileExists (oldJournalName);
+
+		moduleHashes.clear ();
+		storeFile.close ();
+		runCount = 0;
+		storeForeign = false;
+
+		if (!loadBinary (getStoreFileName ())) {
+
+			// first run with the binary format: take over the text store
+
+			if (loadText (baseName) && alone) {
+				saveStore ();
+				deleteFileOrDir (baseName);
+			}
+
+		}
+
+		// the old journal of an interrupted compaction comes first
+
+		state = CReplayState ();
+		state.journalSize = 0;
+		state.journalLoaded = 0;
+		state.journalRuns = 0;
+
+		replayJournal (oldJournalName, state);
+		replayJournal (getJournalFileName (), state);
+
+		if (!compacting || fileExists (oldJournalName))
+			break;
+
+	}
+
+	journalLoaded = state.journalLoaded;
+
+	applyJournal (state);
+
+}
+
+void CHashStoreShard::saveStore () {
+
+	if (!storeOpened)
+		return;
+
+	// the current file may be mapped, so never write it in place
+
+	if (!writeFileAtomically (getStoreFileName (), buildStore (false, NULL, NULL)))
+		console.error ("lick: failed to save " + getStoreFileName ());
+
+}
+
+string CHashStoreShard::buildStore (bool collect, size_t *removedHashes, const string *onlyModule) {
+
+	// with collect, drop what has not been used for long, then the least recently used over the cap
+
+	vector<pair<uint64_t,size_t>> usage;
+	size_t totalHashes = 0;
+
+	for (map<string,CModuleHashStore>::iterator it = moduleHashes.begin (); it != moduleHashes.end (); it++) {
+		map<string,CTargetHashStore>& targetHashes = it -> second.getHashes ();
+		for (map<string,CTargetHashStore>::iterator i1 = targetHashes.begin (); i1 != targetHashes.end (); i1++) {
+			vector<CDigest> hashes;
+			i1 -> second.getHashes (hashes);
+			usage.push_back (make_pair (i1 -> second.getLastUsedRun (), hashes.size ()));
+			totalHashes += hashes.size ();
+		}
+	}
+
+	uint64_t oldestKept = 0;
+
+	if (collect) {
+
+		if (runCount > HASHSTORE_GC_RUNS)
+			oldestKept = runCount - HASHSTORE_GC_RUNS;
+
+		sort (usage.begin (), usage.end (), [] (const pair<uint64_t,size_t>& a, const pair<uint64_t,size_t>& b) { return a.first > b.first; });
+
+		size_t kept = 0;
+		for (size_t i = 0; i < usage.size () && usage[i].first >= oldestKept; i++) {
+			if (kept + usage[i].second > HASHSTORE_GC_MAX_DIGESTS && usage[i].first != usage[0].first) {
+				oldestKept = usage[i].first + 1;
+				break;
+			}
+			kept += usage[i].second;
+		}
+
+	}
+
+	vector<string> names;
+	map<string,uint32_t> nameIndex;
+
+	auto intern = [&] (const string& name) -> uint32_t {
+		map<string,uint32_t>::iterator it = nameIndex.find (name);
+		if (it != nameIndex.end ())
+			return it -> second;
+		names.push_back (name);
+		return nameIndex[name] = names.size () - 1;
+	};
+
+	string groups;
+	vector<CDigest> digests;
+
+	for (map<string,CModuleHashStore>::iterator it = moduleHashes.begin (); it != moduleHashes.end (); it++) {
+
+		if (onlyModule != NULL && it -> first != *onlyModule)
+			continue;
+
+		map<string,CTargetHashStore>& targetHashes = it -> second.getHashes ();
+
+		for (map<string,CTargetHashStore>::iterator i1 = targetHashes.begin (); i1 != targetHashes.end (); i1++) {
+
+			vector<CDigest> hashes;
+			i1 -> second.getHashes (hashes);
+
+			uint64_t lastUsedRun = i1 -> second.getLastUsedRun ();
+
+			if (hashes.empty () || lastUsedRun < oldestKept)
+				continue;
+
+			uint32_t moduleIndex = intern (it -> first);
+			uint32_t targetIndex = intern (i1 -> first);
+			uint64_t first = digests.size ();
+			uint64_t count = hashes.size ();
+
+			groups.append ((const char *) &moduleIndex, 4);
+			groups.append ((const char *) &targetIndex, 4);
+			groups.append ((const char *) &first, 8);
+			groups.append ((const char *) &count, 8);
+			groups.append ((const char *) &lastUsedRun, 8);
+
+			digests.insert (digests.end (), hashes.begin (), hashes.end ());
+
+		}
 
-	if (prevRunHashes.find (hash) != prevRunHashes.end ()) {
-		hashes.insert (hash);
-		return true;
 	}
-	
-	if (hashes.find (hash) != hashes.end ())
-		return true;
-		
-	return false;
-	
+
+	string namesBlock;
+	for (size_t i = 0; i < names.size (); i++) {
+		uint32_t length = names[i].length ();
+		namesBlock.append ((const char *) &length, 4);
+		namesBlock.append (names[i]);
+	}
+
+	CHashStoreHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, HASHSTORE_MAGIC, sizeof (header.magic));
+	header.version = HASHSTORE_VERSION;
+	header.nameCount = names.size ();
+	header.groupCount = groups.length () / 32;
+	header.namesOffset = sizeof (header);
+	header.groupsOffset = header.namesOffset + namesBlock.length ();
+	header.digestsOffset = header.groupsOffset + groups.length ();
+	header.digestCount = digests.size ();
+	header.runCount = runCount;
+	header.algorithm = CFingerprint::getAlgorithm ();
+
+	if (removedHashes != NULL)
+		(*removedHashes) = totalHashes - digests.size ();
+
+	string contents ((const char *) &header, sizeof (header));
+	contents += namesBlock;
+	contents += groups;
+	if (!digests.empty ())
+		contents.append ((const char *) &digests[0], digests.size () * DIGEST_SIZE);
+
+	return contents;
+
 }
 
-void CTargetHashStore::addHash (const string& hash) {
-	touched = true;
-	hashes.insert (hash);
+bool CHashStoreShard::containsHash (const string& module, const string& target, const CDigest& hash) {
+
+	open ();
+
+	map<string,CModuleHashStore>::iterator it = moduleHashes.find (module);
+	if (it == moduleHashes.end())
+		return false;
+
+	CTargetHashStore *targetStore = it -> second.findTarget (target);
+	if (targetStore == NULL)
+		return false;
+
+	// a lookup marks the hash as used, which decides what is kept
+
+	touchTarget (*targetStore, module, target);
+
+	bool recorded;
+	bool found = targetStore -> containsHash (hash, recorded);
+	if (recorded)
+		appendJournal ('U', module, target, &hash);
+
+	return found;
 }
 
-void CTargetHashStore::clear () {
-	touched = true;
-	hashes.clear ();
+bool CHashStoreShard::peekHash (const string& module, const string& target, const CDigest& hash) {
+
+	open ();
+
+	map<string,CModuleHashStore>::iterator it = moduleHashes.find (module);
+	if (it == moduleHashes.end())
+		return false;
+
+	CTargetHashStore *targetStore = it -> second.findTarget (target);
+	if (targetStore == NULL)
+		return false;
+
+	return targetStore -> peekHash (hash);
 }
 
-void CTargetHashStore::load (const string& hash) {
-	prevRunHashes.insert (hash);
+void CHashStoreShard::addHash (const string& module, const string& target, const CDigest& hash) {
+
+	open ();
+
+	CTargetHashStore& targetStore = moduleHashes[module].getTarget (target);
+	touchTarget (targetStore, module, target);
+
+	if (targetStore.addHash (hash))
+		appendJournal ('A', module, target, &hash);
+
 }
 
-set<string>& CTargetHashStore::getHashes () {
-	if (touched)
-		return hashes;
-	else
-		return prevRunHashes;
+void CHashStoreShard::clear (const string& module) {
+
+	open ();
+
+	map<string,CModuleHashStore>::iterator it = moduleHashes.find (module);
+	if (it != moduleHashes.end())
+		it -> second.clear ();
+
+	appendJournal ('C', module, "", NULL);
+
 }
 
-bool CModuleHashStore::containsHash (const string& target, const string& hash) {
+void CHashStoreShard::exportText (ostream& os) {
 
-	map<string,CTargetHashStore>::iterator it = targetHashes.find (target);
-	if (it == targetHashes.end ())
-		return false;
-		
-	return it -> second.containsHash (hash);
+	open ();
+
+	for (map<string,CModuleHashStore>::iterator it = moduleHashes.begin (); it != moduleHashes.end (); it++) {
+
+		map<string,CTargetHashStore>& targetHashes = it -> second.getHashes ();
+
+		for (map<string,CTargetHashStore>::iterator i1 = targetHashes.begin (); i1 != targetHashes.end (); i1++) {
+
+			vector<CDigest> hashes;
+			i1 -> second.getHashes (hashes);
+
+			for (vector<CDigest>::iterator i2 = hashes.begin (); i2 != hashes.end (); i2++)
+				os << it -> first << "|" << i1 -> first << "|" << i2 -> toHex () << endl;
+
+		}
+
+	}
+
+}
+
+void CHashStoreShard::importText (const string& fileName, const string& module) {
+
+	// replaces the shard with the lines of module in fileName
+
+	open ();
+
+	if (compactThread.joinable ())
+		compactThread.join ();
+
+	closeJournal ();
+
+	// other lick processes must be done with the shard
+
+	storeFileLock.lock (true, true);
+
+	moduleHashes.clear ();
+	storeFile.close ();
+
+	if (!loadText (fileName))
+		throw runtime_error ("Failed to read " + fileName);
+
+	for (map<string,CModuleHashStore>::iterator it = moduleHashes.begin (); it != moduleHashes.end (); ) {
+		if (it -> first != module)
+			moduleHashes.erase (it++);
+		else
+			it++;
+	}
+
+	// imported hashes count as used now, or the next compaction would collect them
+
+	for (map<string,CModuleHashStore>::iterator it = moduleHashes.begin (); it != moduleHashes.end (); it++) {
+		map<string,CTargetHashStore>& targetHashes = it -> second.getHashes ();
+		for (map<string,CTargetHashStore>::iterator i1 = targetHashes.begin (); i1 != targetHashes.end (); i1++)
+			i1 -> second.setLastUsedRun (runCount);
+	}
+
+	saveStore ();
+	deleteFileOrDir (getJournalFileName () + ".old");
+	deleteFileOrDir (getJournalFileName ());
+	journalLoaded = 0;
+
+	storeFileLock.lock (false, true);
+
+	openJournal ();
+	storeChanged = false;
 
 }
 
-void CModuleHashStore::addHash (const string& target, const string& hash) {
-	targetHashes[target].addHash (hash);
+void CHashStoreShard::remove () {
+
+	if (compactThread.joinable ())
+		compactThread.join ();
+
+	closeJournal ();
+
+	if (!storeOpened)
+		storeFileLock.open (baseName + ".lock");
+
+	// other lick processes must be done with the shard
+
+	storeFileLock.lock (true, true);
+
+	deleteFileOrDir (getStoreFileName ());
+	deleteFileOrDir (getJournalFileName () + ".old");
+	deleteFileOrDir (getJournalFileName ());
+
+	close ();
+
 }
 
-void CModuleHashStore::clear () {
+size_t CHashStoreShard::collectGarbage () {
 
-	for (map<string,CTargetHashStore>::iterator it = targetHashes.begin (); it != targetHashes.end (); it++) 
-		it -> second.clear ();
+	open ();
+
+	if (compactThread.joinable ())
+		compactThread.join ();
+
+	closeJournal ();
+
+	// other lick processes must be done with the shard, and may have added to it meanwhile
+
+	storeFileLock.lock (true, true);
+
+	CReplayState state;
+	loadStore (true, state);
+
+	size_t removedHashes = 0;
+	if (writeFileAtomically (getStoreFileName (), buildStore (true, &removedHashes, NULL))) {
+		deleteFileOrDir (getJournalFileName () + ".old");
+		deleteFileOrDir (getJournalFileName ());
+		journalLoaded = 0;
+	} else
+		console.error ("lick: failed to save " + getStoreFileName ());
+
+	storeFileLock.lock (false, true);
+
+	openJournal ();
+	storeChanged = false;
+
+	return removedHashes;
+
+}
+
+void CHashStoreShard::getModules (vector<string>& result) {
+
+	for (map<string,CModuleHashStore>::iterator it = moduleHashes.begin (); it != moduleHashes.end (); it++)
+		if (!it -> second.getHashes ().empty ())
+			result.push_back (it -> first);
 
 }
 
-void CModuleHashStore::load (const string& target, const string& hash) {
-	targetHashes[target].load (hash);
+bool CHashStoreShard::saveModule (const string& module, const string& fileName) {
+	return writeFileAtomically (fileName, buildStore (false, NULL, &module));
 }
 
-map<string,CTargetHashStore>& CModuleHashStore::getHashes () {
-	return targetHashes;
+void CHashStoreShard::flush () {
+
+	if (storeChanged && journal != NULL) {
+		if (!syncFile (journal))
+			console.error ("lick: failed to sync " + getJournalFileName ());
+	}
+
+	storeChanged = false;
+
+}
+
+void CHashStoreShard::close () {
+
+	if (compactThread.joinable ())
+		compactThread.join ();
+
+	closeJournal ();
+	storeFileLock.close ();
+
+	moduleHashes.clear ();
+	storeFile.close ();
+
+	storeOpened = false;
+	storeChanged = false;
+	runRecorded = false;
+
 }
 
 CHashStore::CHashStore () {
-	
+
 	storeOpened = false;
-	storeFileName = getCurrentDirectory () + getPathSeparator () + ".lick" + getPathSeparator () + "hashstore";
-	
+	timerStopping = false;
+
+	random_device random;
+	sessionId = ((uint64_t) random () << 32) ^ random () ^ (uint64_t) chrono::system_clock::now ().time_since_epoch ().count ();
+
+	storeDirName = getStateDirectory ("");
+
 }
 
 void CHashStore::setNameFromModule (const string& moduleName) {
 
-	if (!storeOpened) {
-	
-		size_t pos = moduleName.find_last_of (getAnyPathSeparator ());
-		string dirName = moduleName.substr (0, pos);
-		
-		storeFileName = dirName + getPathSeparator () + ".lick" + getPathSeparator () + "hashstore";
-		
-	}
-	
+	lock_guard<mutex> guard (storeLock);
+
+	if (!storeOpened)
+		storeDirName = getStateDirectory (moduleName);
+
+}
+
+string CHashStore::getShardDirName () {
+	return storeDirName + getPathSeparator () + "hashstore.d";
 }
 
 void CHashStore::openStore () {
-	if (!storeOpened) {
 
-		size_t lastPos = storeFileName.find_last_of (getPathSeparator ());
-		if (lastPos != string::npos) {
-			string dirPath = storeFileName.substr (0, lastPos);
-			if (!dirPath.empty ()) {
-				makeDirs (dirPath);
-			}
-			
-			ifstream ifs;
-			ifs.open (storeFileName);
-			if (ifs.is_open ()) {
-
-				string line;
-				
-				while (getline (ifs, line)) {
-					if (!line.empty ()) {
-					
-						size_t pos = line.find_first_of ("|");
-						if (pos == string::npos)
-							continue;
-							
-						string moduleName = line.substr (0, pos);
-						
-						size_t pos1 = line.find_first_of ("|", pos+1);
-						if (pos1 == string::npos)
-							continue;
-							
-						string targetName = line.substr (pos+1, pos1 - (pos + 1));
-						string hash = line.substr (pos1+1);
-						
-						moduleHashes[moduleName].load (targetName, hash);
-						
-					}
-				}
-			
-				ifs.close ();
-			}
+	if (storeOpened)
+		return;
+
+	storeOpened = true;
+	makeDirs (getShardDirName ());
+
+	// a store from before the split: hand each module its own shard, then drop it
+
+	string legacyName = storeDirName + getPathSeparator () + "hashstore";
+
+	if (fileExists (legacyName + ".bin") || fileExists (legacyName + ".journal") || fileExists (legacyName)) {
+
+		CHashStoreShard legacy (legacyName, sessionId);
+		legacy.open (true);
+
+		vector<string> modules;
+		legacy.getModules (modules);
+
+		for (vector<string>::iterator it = modules.begin (); it != modules.end (); it++) {
+			string shardFileName = getShardByName (getShardName (*it)).getStoreFileName ();
+			if (!fileExists (shardFileName) && !legacy.saveModule (*it, shardFileName))
+				console.error ("lick: failed to save " + shardFileName);
 		}
-		
-		storeOpened = true;
-	}
-}
-
-void CHashStore::saveStore () {
-
-	if (storeOpened) {
-		
-		ofstream ofs;
-		ofs.open (storeFileName);
-		if (ofs.is_open ()) {
-			
-			for (map<string,CModuleHashStore>::iterator it = moduleHashes.begin (); it != moduleHashes.end (); it++) {
-			
-				string moduleName = it -> first;
-				map<string,CTargetHashStore>& targetHashes = it -> second.getHashes ();
-			
-				for (map<string,CTargetHashStore>::iterator i1 = targetHashes.begin (); i1 != targetHashes.end (); i1++) {
-				
-					string targetName = i1 -> first;
-					set<string>& hashes = i1 -> second.getHashes ();
-					
-					for (set<string>::iterator i2 = hashes.begin (); i2 != hashes.end (); i2++) {
-					
-						string hash = (*i2);
-						ofs << moduleName << "|" << targetName << "|" << hash << endl;
-					
-					}
-				
-				}
-			
+
+		legacy.remove ();
+		deleteFileOrDir (legacyName + ".lock");
+
+	}
+
+}
+
+string CHashStore::getShardName (const string& module) {
+
+	// readable, and unique even for modules with the same file name
+
+	string fileName = extractFileName (module);
+	for (size_t i = 0; i < fileName.length (); i++)
+		if (!isalnum ((unsigned char) fileName[i]) && fileName[i] != '.' && fileName[i] != '-')
+			fileName[i] = '_';
+
+	// always SHA1, so the shard names do not depend on lick --hash
+
+	SHA1 hash;
+	hash.update (module);
+
+	return getShardDirName () + getPathSeparator () + fileName + "-" + hash.final ().substr (0, 16);
+
+}
+
+CHashStoreShard& CHashStore::getShard (const string& module) {
+
+	openStore ();
+
+	CHashStoreShard& shard = getShardByName (getShardName (module));
+	shard.open ();
+
+	return shard;
+
+}
+
+CHashStoreShard& CHashStore::getShardByName (const string& baseName) {
+
+	map<string,shared_ptr<CHashStoreShard>>::iterator it = shards.find (baseName);
+	if (it != shards.end ())
+		return *(it -> second);
+
+	shared_ptr<CHashStoreShard> shard (new CHashStoreShard (baseName, sessionId));
+	shards[baseName] = shard;
+
+	return *shard;
+
+}
+
+void CHashStore::listShards (set<string>& result) {
+
+	static const char *extensions[] = { ".bin", ".journal", ".journal.old" };
+
+	list<string> files = getFilesInPath (getShardDirName ());
+
+	for (list<string>::iterator it = files.begin (); it != files.end (); it++) {
+
+		string fileName = extractFileName (*it);
+
+		for (size_t i = 0; i < sizeof (extensions) / sizeof (extensions[0]); i++) {
+
+			string extension (extensions[i]);
+
+			if (fileName.length () > extension.length () && fileName.compare (fileName.length () - extension.length (), extension.length (), extension) == 0) {
+				result.insert (getShardDirName () + getPathSeparator () + fileName.substr (0, fileName.length () - extension.length ()));
+				break;
 			}
-			
-			ofs.close ();
+
 		}
-		
+
 	}
-		
+
 }
 
 bool CHashStore::containsHash (const string& module, const string& target, const string& hash) {
 
-	openStore ();
-	map<string,CModuleHashStore>::iterator it = moduleHashes.find (module);
-	if (it == moduleHashes.end())
+	lock_guard<mutex> guard (storeLock);
+
+	CDigest digest;
+	if (!CDigest::fromHex (hash, digest))
 		return false;
-		
-	bool rc = it -> second.containsHash (target, hash);
-	saveStore ();
-	return rc;
+
+	return getShard (module).containsHash (module, target, digest);
+
+}
+
+bool CHashStore::peekHash (const string& module, const string& target, const string& hash) {
+
+	lock_guard<mutex> guard (storeLock);
+
+	CDigest digest;
+	if (!CDigest::fromHex (hash, digest))
+		return false;
+
+	return getShard (module).peekHash (module, target, digest);
+
 }
 
 void CHashStore::addHash (const string& module, const string& target, const string& hash) {
 
-	openStore ();
-	moduleHashes[module].addHash (target, hash);
-	saveStore ();
+	lock_guard<mutex> guard (storeLock);
+
+	CDigest digest;
+	if (!CDigest::fromHex (hash, digest))
+		throw runtime_error ("Invalid hash " + hash);
+
+	getShard (module).addHash (module, target, digest);
 
 }
 
 void CHashStore::clear (const string& module) {
 
+	lock_guard<mutex> guard (storeLock);
+	getShard (module).clear (module);
+
+}
+
+void CHashStore::exportText (const string& fileName) {
+
+	lock_guard<mutex> guard (storeLock);
 	openStore ();
 
-	map<string,CModuleHashStore>::iterator it = moduleHashes.find (module);
-	if (it != moduleHashes.end())
-		it -> second.clear ();
+	ofstream ofs (fileName);
+	if (!ofs.is_open ())
+		throw runtime_error ("Failed to write " + fileName);
 
-	saveStore ();
+	set<string> names;
+	listShards (names);
+
+	for (set<string>::iterator it = names.begin (); it != names.end (); it++)
+		getShardByName (*it).exportText (ofs);
+
+}
+
+void CHashStore::importText (const string& fileName) {
+
+	// replaces the store: whatever was there before is dropped, so only once every line
+	// of the file has been read correctly
+
+	lock_guard<mutex> guard (storeLock);
+
+	set<string> modules;
+
+	ifstream ifs (fileName);
+	if (!ifs.is_open ())
+		throw runtime_error ("Failed to read " + fileName);
+
+	string line;
+	size_t lineNumber = 0;
+
+	while (getline (ifs, line)) {
+
+		lineNumber++;
+
+		if (line.empty () || line == "\r")
+			continue;
+
+		string moduleName, targetName;
+		CDigest hash;
+
+		if (!parseTextLine (line, moduleName, targetName, hash)) {
+			stringstream ss;
+			ss << "[" << fileName << ":" << lineNumber << "]: expected module|target|digest with a " << (DIGEST_SIZE * 2) << " digit hex digest, nothing was imported";
+			throw runtime_error (ss.str ());
+		}
+
+		modules.insert (moduleName);
+
+	}
+
+	if (ifs.bad ())
+		throw runtime_error ("Failed to read " + fileName);
+
+	ifs.close ();
+
+	openStore ();
+
+	set<string> names;
+	listShards (names);
+
+	for (set<string>::iterator it = names.begin (); it != names.end (); it++)
+		getShardByName (*it).remove ();
+
+	for (set<string>::iterator it = modules.begin (); it != modules.end (); it++)
+		getShard (*it).importText (fileName, *it);
+
+}
+
+void CHashStore::collectGarbage () {
+
+	lock_guard<mutex> guard (storeLock);
+	openStore ();
+
+	set<string> names;
+	listShards (names);
+
+	size_t removedHashes = 0;
+	for (set<string>::iterator it = names.begin (); it != names.end (); it++)
+		removedHashes += getShardByName (*it).collectGarbage ();
+
+	stringstream ss;
+	ss << "lick: removed " << removedHashes << " hashes from " << getShardDirName ();
+	console.error (ss.str ());
+
+}
+
+void CHashStore::flush () {
+
+	lock_guard<mutex> guard (storeLock);
+
+	for (map<string,shared_ptr<CHashStoreShard>>::iterator it = shards.begin (); it != shards.end (); it++)
+		it -> second -> flush ();
+
+}
+
+void CHashStore::timerLoop () {
+
+	unique_lock<mutex> guard (timerLock);
+
+	while (!timerStopping) {
+
+		timerSignal.wait_for (guard, chrono::seconds (HASHSTORE_FLUSH_INTERVAL));
+		if (timerStopping)
+			break;
+
+		guard.unlock ();
+		flush ();
+		guard.lock ();
+
+	}
 
 }
 
+void CHashStore::startFlushTimer () {
+
+	lock_guard<mutex> guard (timerLock);
+
+	if (!timerThread.joinable ()) {
+		timerStopping = false;
+		timerThread = thread (&CHashStore::timerLoop, this);
+	}
+
+}
+
+void CHashStore::stopFlushTimer () {
+
+	{
+		lock_guard<mutex> guard (timerLock);
+		timerStopping = true;
+	}
+	timerSignal.notify_all ();
+
+	if (timerThread.joinable ())
+		timerThread.join ();
+
+	flush ();
+
+	lock_guard<mutex> guard (storeLock);
+
+	// closing waits for background compactions
+
+	CReleaseInterpreter unlocked;
+
+	for (map<string,shared_ptr<CHashStoreShard>>::iterator it = shards.begin (); it != shards.end (); it++)
+		it -> second -> close ();
+
+}
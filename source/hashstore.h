@@ -4,73 +4,411 @@
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <iostream>
+
+#include "sys_funcs.h"
+#include "fingerprint.h"
 
 using namespace std;
 
+#define DIGEST_SIZE FINGERPRINT_SIZE
+
+/*
+	Raw fingerprint digest; depends hashes are kept in this form instead of 40-char hex strings.
+	It has no alignment requirements, so arrays of it can live directly in a mapped file.
+*/
+
+class CDigest {
+
+	public:
+
+		unsigned char bytes[DIGEST_SIZE];
+
+		static bool fromHex (const string& hex, CDigest& digest);
+		string toHex () const;
+
+		bool operator< (const CDigest& other) const {
+			return memcmp (bytes, other.bytes, DIGEST_SIZE) < 0;
+		}
+
+};
+
+/*
+	Open-addressing set of digests (linear probing, power-of-two capacity, at most half full).
+	A digest is already uniformly distributed, so its first bytes serve as the hash. Costs
+	about 46 bytes per entry against 60 for a set<CDigest> node (bench/digestset.cpp), with
+	no allocation per insert and a tenth of its lookup time.
+*/
+
+class CDigestSet {
+
+	private:
+
+		vector<CDigest> slots;
+		vector<unsigned char> used;
+		size_t count;
+
+		size_t findSlot (const CDigest& hash) const;
+		void grow ();
+
+	public:
+
+		CDigestSet () {
+			count = 0;
+		}
+
+		bool insert (const CDigest& hash);
+		bool contains (const CDigest& hash) const;
+		void clear ();
+
+		size_t size () const {
+			return count;
+		}
+
+		void getAll (vector<CDigest>& result) const;
+
+};
+
 class CTargetHashStore {
 
 	private:
-	
-		set<string> prevRunHashes;
-		set<string> hashes;
+
+		// hashes of the previous run, sorted; in the mapped store file or in loadedHashes
+
+		const CDigest *prevRunHashes;
+		size_t prevRunCount;
+		vector<CDigest> loadedHashes;
+
+		// one bit per previous run hash used again in this run, and the hashes new in it
+
+		vector<bool> prevRunSeen;
+		CDigestSet addedHashes;
 		bool touched;
-		
+
+		// number of the last run which used the target, for garbage collection
+
+		uint64_t lastUsedRun;
+
 	public:
-	
+
 		CTargetHashStore () {
+			prevRunHashes = NULL;
+			prevRunCount = 0;
 			touched = false;
+			lastUsedRun = 0;
 		}
-	
-		bool containsHash (const string& hash);
-		void addHash (const string& hash);
+
+		// recorded / added tell whether the hash is new to this run's set
+
+		bool containsHash (const CDigest& hash, bool& recorded);
+		bool peekHash (const CDigest& hash);
+		bool addHash (const CDigest& hash);
 		void clear ();
-		
-		void load (const string& hash);
-		set<string>& getHashes ();
+
+		bool isTouched () {
+			return touched;
+		}
+
+		uint64_t getLastUsedRun () {
+			return lastUsedRun;
+		}
+
+		void setLastUsedRun (uint64_t run) {
+			lastUsedRun = run;
+		}
+
+		void setPrevRun (const CDigest *digests, size_t count);
+		void load (const CDigest& hash);
+		void finishLoad ();
+		void replacePrevRun (const set<CDigest>& digests);
+
+		void getHashes (vector<CDigest>& result);
+		void getPrevRunHashes (vector<CDigest>& result);
 
 };
 
 class CModuleHashStore {
 
 	private:
-	
+
 		map<string,CTargetHashStore> targetHashes;
-		
+
 	public:
-	
-		bool containsHash (const string& target, const string& hash);
-		void addHash (const string& target, const string& hash);
+
 		void clear ();
-		
-		void load (const string& target, const string& hash);
+
+		CTargetHashStore *findTarget (const string& target);
+		CTargetHashStore& getTarget (const string& target);
 		map<string,CTargetHashStore>& getHashes ();
 
 };
 
-class CHashStore {
-	
+/*
+	Shard file (<shard>.bin) layout, native byte order, it is a local cache:
+
+		header      see CHashStoreHeader
+		names       nameCount x { uint32 length, bytes }, module and target names
+		groups      groupCount x { uint32 module name, uint32 target name, uint64 first digest, uint64 digest count,
+		            uint64 last used run }
+		digests     digestCount x 20 bytes, sorted within each group
+
+	runCount in the header numbers the runs which used the shard. algorithm is the
+	FingerprintAlgorithm of the digests, 0 (SHA1) in files from before it was recorded; a
+	shard written with another algorithm than the current one starts empty, as none of its
+	digests could match. Version 1 files (no run numbers, 24-byte groups) are still read.
+
+	The file is mapped and searched in place, so startup does not depend on its size. The old
+	text format (.lick/hashstore, "module|target|hex" per line) is imported when there is no
+	binary store yet, and can be exported / imported with lick --export-hashstore / --import-hashstore.
+*/
+
+#define HASHSTORE_MAGIC "LICKHS\r\n"
+#define HASHSTORE_VERSION 2
+
+struct CHashStoreHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t nameCount;
+	uint32_t groupCount;
+	uint32_t algorithm;
+	uint64_t namesOffset;
+	uint64_t groupsOffset;
+	uint64_t digestsOffset;
+	uint64_t digestCount;
+	uint64_t runCount;
+};
+
+/*
+	Changes are appended to <shard>.journal as they happen, one small record per
+	operation, so a depends hit costs a few dozen bytes instead of a rewrite of the store:
+
+		'T' session module target           first use of a target in a run, it starts from nothing
+		'U' session module target digest    hash of the previous run used again
+		'A' session module target digest    hash added
+		'C' session module                  module cleared
+		'R' session algorithm               a run started using the store, algorithm in place of the module
+		'S' session loaded                  the session began, having loaded the journal up to byte loaded
+		'E' session                         the session ended, the shard was closed
+
+	The session is a random uint64 per lick process, names are uint32 length + bytes, digests
+	20 bytes, loaded a uint64. The algorithm is the name of the fingerprint algorithm, empty for SHA1 in
+	journals from before it was recorded; records of sessions with another algorithm are skipped. Every record is flushed to the OS right away, and flush () fsyncs the journal at
+	the end of every target, at exit and every HASHSTORE_FLUSH_INTERVAL seconds. On load the
+	journal is replayed over <shard>.bin; a torn last record is dropped. Once the journal
+	outgrows HASHSTORE_JOURNAL_LIMIT and the shard itself, it is renamed to
+	<shard>.journal.old and the replayed state is written as the new <shard>.bin by a
+	background thread, which then deletes the old journal. Replaying a journal over a store
+	that already contains it gives the same result, so a compaction killed halfway loses nothing;
+	a lick which loads the shard while that thread finishes loads it again.
+
+	Several lick processes may share the store (sub-projects with using, parallel builds).
+	Each appends its own records, and replay merges them: a target keeps the hashes of its
+	latest run plus those of every session that was live while it ran, from the point where
+	the latest one loaded the journal ('S') to where the other ended ('E', or its last record
+	if it was killed). The latest run could not see what those wrote, so it did not replace it. Every process holds a shared lock
+	on <shard>.lock while it has the shard open; loading and compacting need it
+	exclusively, so compaction only happens in a process which is alone with the shard. Within a process
+	the store may be used from any thread.
+
+	Compaction also collects garbage: targets no run has used for HASHSTORE_GC_RUNS runs are
+	dropped, and if more than HASHSTORE_GC_MAX_DIGESTS hashes remain, the least recently used
+	targets go until the rest fits. Targets which ran keep only the hashes they used anyway,
+	so the target is the unit of eviction. The journal is compacted after HASHSTORE_COMPACT_RUNS
+	runs at the latest, and lick --gc-hashstore does it at once.
+*/
+
+#define HASHSTORE_JOURNAL_LIMIT (1024 * 1024)
+#define HASHSTORE_FLUSH_INTERVAL 5
+
+#define HASHSTORE_GC_RUNS 100
+#define HASHSTORE_GC_MAX_DIGESTS (2 * 1000 * 1000)
+#define HASHSTORE_COMPACT_RUNS 20
+
+// journal replay state of one target, see CHashStore::applyJournal
+
+struct CReplaySession {
+	set<CDigest> hashes;
+};
+
+// where in the replayed journals a session began and ended, byte offsets from the first one
+
+struct CReplaySpan {
+	uint64_t start;
+	uint64_t end;
+};
+
+struct CReplayTarget {
+	set<CDigest> hashes;
+	map<uint64_t,CReplaySession> sessions;
+	bool anyStarted;
+	uint64_t lastStarted;
+	uint64_t lastUsedRun;
+};
+
+struct CReplayState {
+	map<string,map<string,CReplayTarget>> targets;
+	map<uint64_t,uint64_t> sessionRuns;
+	map<uint64_t,CReplaySpan> sessionSpans;
+	set<uint64_t> foreignSessions;
+	size_t journalSize;
+	size_t journalLoaded;
+	uint64_t journalRuns;
+};
+
+/*
+	One shard of the store: the hashes of one module, in its own hashstore.bin-format file,
+	journal and lock file, all named baseName + extension. The store locks around every call.
+*/
+
+class CHashStoreShard {
+
 	private:
-	
+
 		map<string,CModuleHashStore> moduleHashes;
-	
-		string storeFileName;
+		CMappedFile storeFile;
+
+		string baseName;
 		bool storeOpened;
-		
-		void openStore ();
+		bool storeChanged;
+
+		CFileLock storeFileLock;
+
+		FILE *journal;
+		uint64_t sessionId;
+		bool runRecorded;
+		bool sessionRecorded;
+		uint64_t journalLoaded;
+		uint64_t runCount;
+		bool storeForeign;
+		thread compactThread;
+
 		void saveStore ();
-		
+		string buildStore (bool collect, size_t *removedHashes, const string *onlyModule);
+		void loadStore (bool alone, CReplayState& state);
+
+		bool loadBinary (const string& fileName);
+		bool loadText (const string& fileName);
+
+		void replayJournal (const string& fileName, CReplayState& state);
+		void applyJournal (CReplayState& state);
+		void compact ();
+		void writeCompacted (string contents, string oldJournalName);
+
+		void openJournal ();
+		void closeJournal ();
+		void appendJournal (char op, const string& module, const string& target, const CDigest *hash);
+		bool writeJournal (const string& record);
+		void touchTarget (CTargetHashStore& targetStore, const string& module, const string& target);
+
+		string getJournalFileName ();
+
+	public:
+
+		CHashStoreShard (const string& baseName, uint64_t sessionId);
+		~CHashStoreShard ();
+
+		void open (bool exclusive = false);
+		void close ();
+
+		bool containsHash (const string& module, const string& target, const CDigest& hash);
+		bool peekHash (const string& module, const string& target, const CDigest& hash);
+		void addHash (const string& module, const string& target, const CDigest& hash);
+		void clear (const string& module);
+
+		void exportText (ostream& os);
+		void importText (const string& fileName, const string& module);
+		void remove ();
+		size_t collectGarbage ();
+
+		string getStoreFileName ();
+
+		void getModules (vector<string>& result);
+		bool saveModule (const string& module, const string& fileName);
+
+		void flush ();
+
+};
+
+/*
+	All hashes of a project: .lick/hashstore.d holds one shard per module, named after the
+	module file plus a hash of its path. A shard is opened (and locked) the first time its
+	module is looked up, so licking a sub-project reads and writes only its own hashes, and
+	builds of different sub-projects never contend. A store from before the split
+	(.lick/hashstore.bin and its journal) is divided into shards on first use.
+*/
+
+class CHashStore {
+
+	private:
+
+		map<string,shared_ptr<CHashStoreShard>> shards;
+
+		string storeDirName;
+		bool storeOpened;
+		uint64_t sessionId;
+
+		mutex storeLock;
+
+		mutex timerLock;
+		condition_variable timerSignal;
+		thread timerThread;
+		bool timerStopping;
+
+		void timerLoop ();
+
+		void openStore ();
+
+		string getShardDirName ();
+		string getShardName (const string& module);
+		CHashStoreShard& getShard (const string& module);
+		CHashStoreShard& getShardByName (const string& baseName);
+		void listShards (set<string>& result);
+
 	public:
-		
+
 		CHashStore ();
-		
+
 		bool containsHash (const string& module, const string& target, const string& hash);
 		void addHash (const string& module, const string& target, const string& hash);
+
+		// a lookup which leaves no trace: the hash is not marked used, nothing is journaled
+
+		bool peekHash (const string& module, const string& target, const string& hash);
 		void clear (const string& module);
-		
+
 		void setNameFromModule (const string& moduleName);
-	
+
+		void exportText (const string& fileName);
+		void importText (const string& fileName);
+		void collectGarbage ();
+
+		void flush ();
+
+		void startFlushTimer ();
+		void stopFlushTimer ();
+
 };
 
 extern CHashStore hashStore;
 
+class CHashStoreFlusher {
+
+	public:
+
+		CHashStoreFlusher () {
+			hashStore.startFlushTimer ();
+		}
+
+		~CHashStoreFlusher () {
+			hashStore.stopFlushTimer ();
+		}
+
+};
+
 #endif /* __HASHSTORE_H__ */
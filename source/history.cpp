@@ -0,0 +1,157 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+#include "history.h"
+#include "sys_funcs.h"
+#include "console.h"
+
+CDurationHistory durationHistory;
+
+CDurationHistory::CDurationHistory () {
+
+	historyOpened = false;
+	historyChanged = false;
+	historyFileName = getStateDirectory ("") + getPathSeparator () + "durations";
+
+}
+
+void CDurationHistory::setNameFromModule (const string& moduleName) {
+
+	lock_guard<mutex> guard (historyLock);
+
+	if (!historyOpened)
+		historyFileName = getStateDirectory (moduleName) + getPathSeparator () + "durations";
+
+}
+
+void CDurationHistory::openHistory () {
+
+	if (historyOpened)
+		return;
+
+	historyOpened = true;
+
+	ifstream ifs (historyFileName);
+	string line;
+
+	while (getline (ifs, line)) {
+
+		size_t pos = line.find_last_of ("|");
+		if (pos == string::npos)
+			continue;
+
+		durations[line.substr (0, pos)] = atof (line.c_str () + pos + 1);
+
+	}
+
+}
+
+bool CDurationHistory::getDuration (const string& key, double& seconds) {
+
+	lock_guard<mutex> guard (historyLock);
+	openHistory ();
+
+	map<string,double>::iterator it = durations.find (key);
+	if (it == durations.end ())
+		return false;
+
+	usedKeys.insert (key);
+	seconds = it -> second;
+	return true;
+
+}
+
+void CDurationHistory::addDuration (const string& key, double seconds) {
+
+	lock_guard<mutex> guard (historyLock);
+	openHistory ();
+
+	map<string,double>::iterator it = durations.find (key);
+
+	if (it == durations.end ())
+		durations[key] = seconds;
+	else
+		it -> second = (it -> second + seconds) / 2;
+
+	usedKeys.insert (key);
+	historyChanged = true;
+
+}
+
+void CDurationHistory::save () {
+
+	lock_guard<mutex> guard (historyLock);
+
+	if (!historyChanged)
+		return;
+
+	size_t lastPos = historyFileName.find_last_of (getPathSeparator ());
+	if (lastPos != string::npos)
+		makeDirs (historyFileName.substr (0, lastPos));
+
+	stringstream contents;
+	size_t written = 0;
+
+	for (map<string,double>::iterator it = durations.begin (); it != durations.end (); it++) {
+		if (usedKeys.find (it -> first) != usedKeys.end ()) {
+			contents << it -> first << "|" << it -> second << endl;
+			written ++;
+		}
+	}
+
+	for (map<string,double>::iterator it = durations.begin (); it != durations.end () && written < HISTORY_MAX_ENTRIES; it++) {
+		if (usedKeys.find (it -> first) == usedKeys.end ()) {
+			contents << it -> first << "|" << it -> second << endl;
+			written ++;
+		}
+	}
+
+	if (!writeFileAtomically (historyFileName, contents.str ()))
+		console.error ("lick: failed to save " + historyFileName);
+
+	historyChanged = false;
+
+}
+
+thread_local CDurationTimer *CDurationTimer::current = NULL;
+
+CDurationTimer::CDurationTimer (const string& p_key) {
+
+	key = p_key;
+	started = chrono::steady_clock::now ();
+	worked = false;
+
+	parent = current;
+	current = this;
+
+}
+
+CDurationTimer::~CDurationTimer () {
+
+	current = parent;
+
+	if (worked && !uncaught_exception ())
+		durationHistory.addDuration (key, chrono::duration<double> (chrono::steady_clock::now () - started).count ());
+
+}
+
+void CDurationTimer::noteWork () {
+
+	for (CDurationTimer *timer = current; timer != NULL && !timer -> worked; timer = timer -> parent)
+		timer -> worked = true;
+
+}
+
+CDurationTimer *CDurationTimer::getCurrent () {
+
+	return current;
+
+}
+
+void CDurationTimer::setCurrent (CDurationTimer *timer) {
+
+	current = timer;
+
+}
@@ -0,0 +1,86 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include <string>
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <exception>
+#include <atomic>
+
+using namespace std;
+
+/*
+	How long things took on previous runs, kept in .lick/durations next to the hash store.
+	Keys are "target:" + module + name and "for:" + loop hashes, the things a scheduler
+	orders; values are seconds, averaged with the previous run. Schedulers use it to start
+	the longest chains first. Keys not used by this run are kept only up to
+	HISTORY_MAX_ENTRIES in total, since loop hashes change with the items.
+*/
+
+#define HISTORY_MAX_ENTRIES 20000
+
+class CDurationHistory {
+
+	private:
+
+		mutex historyLock;
+		map<string,double> durations;
+		set<string> usedKeys;
+
+		string historyFileName;
+		bool historyOpened;
+		bool historyChanged;
+
+		void openHistory ();
+
+	public:
+
+		CDurationHistory ();
+
+		void setNameFromModule (const string& moduleName);
+
+		bool getDuration (const string& key, double& seconds);
+		void addDuration (const string& key, double seconds);
+
+		void save ();
+
+};
+
+extern CDurationHistory durationHistory;
+
+/*
+	Measures the lifetime of a scope and records it under key, unless the scope is left
+	by an exception (failed work says nothing about how long the work takes) or no
+	command was started in it: a target whose blocks were all up to date took no time
+	worth averaging in. Timers nest per thread, and a worker of a CWorkerPool carries
+	on the timer of the thread which submitted its task, so a command started by it
+	counts for every timer around it.
+*/
+
+class CDurationTimer {
+
+	private:
+
+		string key;
+		chrono::steady_clock::time_point started;
+
+		CDurationTimer *parent;
+		atomic<bool> worked;
+
+		static thread_local CDurationTimer *current;
+
+	public:
+
+		CDurationTimer (const string& p_key);
+		~CDurationTimer ();
+
+		static void noteWork ();
+
+		static CDurationTimer *getCurrent ();
+		static void setCurrent (CDurationTimer *timer);
+
+};
+
+#endif /* __HISTORY_H__ */
@@ -0,0 +1,674 @@
+#include <stdexcept>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _MSC_VER
+# include <unistd.h>
+# include <fcntl.h>
+# include <poll.h>
+#endif
+
+#include "jobs.h"
+#include "threads.h"
+#include "console.h"
+
+CJobTable jobTable;
+CJobServer jobServer;
+
+CJobTable::CJobTable () {
+	nextId = 1;
+}
+
+CJobTable::~CJobTable () {
+
+	for (map<int,shared_ptr<CJob>>::iterator it = jobs.begin (); it != jobs.end (); it++) {
+		if (it -> second -> waiter.joinable ())
+			it -> second -> waiter.join ();
+	}
+
+}
+
+void CJobTable::reap (shared_ptr<CJob> job) {
+
+	int exitCode = finishCommand (job -> process, NULL);
+	jobServer.release (job -> token);
+
+	lock_guard<mutex> guard (tableLock);
+	job -> exitCode = exitCode;
+	job -> finished = true;
+	tableSignal.notify_all ();
+
+}
+
+int CJobTable::collect (shared_ptr<CJob> job) {
+
+	// called with tableLock held, once job -> finished is set
+
+	if (job -> waiter.joinable ())
+		job -> waiter.join ();
+
+	jobs.erase (job -> id);
+	return job -> exitCode;
+
+}
+
+int CJobTable::spawn (const list<string>& params, map<string,string>* env) {
+
+	shared_ptr<CJob> job (new CJob ());
+
+	job -> token = jobServer.acquire ();
+
+	if (!startCommand (params, false, env, job -> process)) {
+		jobServer.release (job -> token);
+		throw runtime_error ("Failed to start " + (params.empty () ? string ("command") : params.front ()));
+	}
+
+	lock_guard<mutex> guard (tableLock);
+
+	job -> id = nextId ++;
+	job -> owner = this_thread::get_id ();
+	job -> waiter = thread (&CJobTable::reap, this, job);
+
+	jobs[job -> id] = job;
+
+	return job -> id;
+
+}
+
+int CJobTable::wait (int id) {
+
+	CReleaseInterpreter unlocked;
+	unique_lock<mutex> guard (tableLock);
+
+	map<int,shared_ptr<CJob>>::iterator it = jobs.find (id);
+	if (it == jobs.end ()) {
+		stringstream ss;
+		ss << "No such job: " << id;
+		throw runtime_error (ss.str ());
+	}
+
+	shared_ptr<CJob> job = it -> second;
+
+	while (!job -> finished)
+		tableSignal.wait (guard);
+
+	return collect (job);
+
+}
+
+int CJobTable::waitAny (const set<int>& among, int& exitCode) {
+
+	CReleaseInterpreter unlocked;
+	unique_lock<mutex> guard (tableLock);
+
+	thread::id self = this_thread::get_id ();
+
+	while (true) {
+
+		bool haveCandidates = false;
+
+		for (map<int,shared_ptr<CJob>>::iterator it = jobs.begin (); it != jobs.end (); it++) {
+
+			shared_ptr<CJob> job = it -> second;
+
+			if (among.empty () ? (job -> owner != self) : (among.find (job -> id) == among.end ()))
+				continue;
+
+			haveCandidates = true;
+
+			if (job -> finished) {
+				int id = job -> id;
+				exitCode = collect (job);
+				return id;
+			}
+
+		}
+
+		if (!haveCandidates)
+			throw runtime_error ("No jobs to wait for");
+
+		tableSignal.wait (guard);
+
+	}
+
+}
+
+bool CJobTable::waitAll (bool ownOnly) {
+
+	CReleaseInterpreter unlocked;
+	unique_lock<mutex> guard (tableLock);
+
+	thread::id self = this_thread::get_id ();
+	bool allSucceeded = true;
+
+	while (true) {
+
+		shared_ptr<CJob> next;
+
+		for (map<int,shared_ptr<CJob>>::iterator it = jobs.begin (); it != jobs.end (); it++) {
+			if (!ownOnly || it -> second -> owner == self) {
+				next = it -> second;
+				break;
+			}
+		}
+
+		if (!next)
+			break;
+
+		while (!next -> finished)
+			tableSignal.wait (guard);
+
+		if (collect (next) != 0)
+			allSucceeded = false;
+
+	}
+
+	return allSucceeded;
+
+}
+
+int CJobTable::getNextId () {
+
+	lock_guard<mutex> guard (tableLock);
+	return nextId;
+
+}
+
+bool CJobTable::waitFinished (int firstId) {
+
+	CReleaseInterpreter unlocked;
+	unique_lock<mutex> guard (tableLock);
+
+	thread::id self = this_thread::get_id ();
+	list<shared_ptr<CJob>> started;
+
+	for (map<int,shared_ptr<CJob>>::iterator it = jobs.lower_bound (firstId); it != jobs.end (); it++) {
+		if (it -> second -> owner == self)
+			started.push_back (it -> second);
+	}
+
+	bool allSucceeded = true;
+
+	for (list<shared_ptr<CJob>>::iterator it = started.begin (); it != started.end (); it++) {
+
+		while (!(*it) -> finished)
+			tableSignal.wait (guard);
+
+		if ((*it) -> exitCode != 0)
+			allSucceeded = false;
+
+	}
+
+	return allSucceeded;
+
+}
+
+bool CJobTable::hasRunning () {
+
+	lock_guard<mutex> guard (tableLock);
+
+	thread::id self = this_thread::get_id ();
+
+	for (map<int,shared_ptr<CJob>>::iterator it = jobs.begin (); it != jobs.end (); it++) {
+		if (it -> second -> owner == self && !it -> second -> finished)
+			return true;
+	}
+
+	return false;
+
+}
+
+CJobServer::CJobServer () {
+
+	implicitFree = true;
+	localTokens = 0;
+	heldTokens = 0;
+	readFd = -1;
+	writeFd = -1;
+	wakeFds[0] = -1;
+	wakeFds[1] = -1;
+
+}
+
+CJobServer::~CJobServer () {
+
+#ifndef _MSC_VER
+	if (wakeFds[0] != -1) {
+		close (wakeFds[0]);
+		close (wakeFds[1]);
+	}
+#endif
+
+}
+
+bool CJobServer::connect (const string& makeflags, int& parentJobs) {
+
+	parentJobs = 0;
+	string auth;
+
+	stringstream ss (makeflags);
+	string word;
+
+	while (ss >> word) {
+		if (word.compare (0, 17, "--jobserver-auth=") == 0)
+			auth = word.substr (17);
+		else if (word.compare (0, 16, "--jobserver-fds=") == 0)
+			auth = word.substr (16);
+		else if (word.compare (0, 2, "-j") == 0 && word.length () > 2)
+			parentJobs = atoi (word.c_str () + 2);
+	}
+
+	if (auth.empty ())
+		return false;
+
+#ifdef _MSC_VER
+
+	// make on Windows uses a named semaphore, which we do not speak
+	return false;
+
+#else
+
+	if (auth.compare (0, 5, "fifo:") == 0) {
+
+		readFd = open (auth.substr (5).c_str (), O_RDWR | O_CLOEXEC);
+		if (readFd == -1) {
+			console.error ("lick: cannot open jobserver " + auth + ", running without it");
+			return false;
+		}
+		writeFd = readFd;
+
+	} else {
+
+		int r = -1, w = -1;
+		if (sscanf (auth.c_str (), "%d,%d", &r, &w) != 2 || fcntl (r, F_GETFD) == -1 || fcntl (w, F_GETFD) == -1) {
+			console.error ("lick: jobserver is not available (make recipe not marked with '+'?), running without it");
+			return false;
+		}
+		readFd = r;
+		writeFd = w;
+
+	}
+
+	return true;
+
+#endif
+
+}
+
+void CJobServer::create (int jobs) {
+
+#ifdef _MSC_VER
+
+	localTokens = jobs - 1;
+
+#else
+
+	int fds[2];
+
+	if (pipe (fds) != 0) {
+		localTokens = jobs - 1;
+		return;
+	}
+
+	for (int i = 0; i < jobs - 1; i++) {
+		char token = '+';
+		if (write (fds[1], &token, 1) != 1)
+			break;
+	}
+
+	readFd = fds[0];
+	writeFd = fds[1];
+
+	// children (make, ninja, nested lick) join our jobserver
+
+	stringstream ss;
+	const char *oldFlags = getenv ("MAKEFLAGS");
+	if (oldFlags != NULL && oldFlags[0] != 0)
+		ss << oldFlags << " ";
+	ss << "-j" << jobs << " --jobserver-auth=" << readFd << "," << writeFd;
+
+	setenv ("MAKEFLAGS", ss.str ().c_str (), 1);
+
+#endif
+
+}
+
+void CJobServer::init (bool jobsGiven) {
+
+	const char *makeflags = getenv ("MAKEFLAGS");
+	int parentJobs = 0;
+
+	if (makeflags != NULL && connect (string (makeflags), parentJobs)) {
+
+		// tokens come from the parent; thread pools just need to be wide enough to use them
+
+		if (!jobsGiven)
+			setJobCount (parentJobs > 0 ? parentJobs : (int) thread::hardware_concurrency ());
+
+	} else if (getJobCount () > 1)
+		create (getJobCount ());
+
+#ifndef _MSC_VER
+
+	// non-blocking, as make has it: another process may take the token between poll and read,
+	// and a blocked read would not see our implicit token come back
+
+	if (readFd != -1) {
+		int flags = fcntl (readFd, F_GETFL);
+		if (flags != -1)
+			fcntl (readFd, F_SETFL, flags | O_NONBLOCK);
+	}
+
+	if (readFd != -1 && pipe2 (wakeFds, O_CLOEXEC) != 0) {
+		wakeFds[0] = -1;
+		wakeFds[1] = -1;
+	}
+#endif
+
+}
+
+int CJobServer::acquire () {
+
+	CReleaseInterpreter unlocked;
+	unique_lock<mutex> guard (serverLock);
+
+	while (true) {
+
+		// the first token is never throttled, otherwise nothing would ever finish
+
+		if (heldTokens > 0 && !monitor.allows (heldTokens)) {
+			serverSignal.wait_for (guard, chrono::milliseconds (250));
+			continue;
+		}
+
+		if (implicitFree) {
+			implicitFree = false;
+			heldTokens ++;
+			return IMPLICIT_JOB_TOKEN;
+		}
+
+		if (readFd == -1 || wakeFds[0] == -1) {
+
+			if (localTokens > 0) {
+				localTokens --;
+				heldTokens ++;
+				return '+';
+			}
+
+			serverSignal.wait_for (guard, chrono::milliseconds (250));
+			continue;
+
+		}
+
+#ifndef _MSC_VER
+
+		guard.unlock ();
+
+		// wait for a token in the jobserver pipe, or for our implicit token to come back
+
+		struct pollfd fds[2];
+		fds[0].fd = readFd;
+		fds[0].events = POLLIN;
+		fds[1].fd = wakeFds[0];
+		fds[1].events = POLLIN;
+
+		int rc = poll (fds, 2, 250);
+
+		// EAGAIN: someone else got the token first, back to poll
+
+		if (rc > 0 && (fds[0].revents & POLLIN)) {
+			unsigned char token;
+			ssize_t count = read (readFd, &token, 1);
+			if (count == 1) {
+				guard.lock ();
+				heldTokens ++;
+				return token;
+			}
+			if (count < 0 && errno != EAGAIN && errno != EINTR)
+				throw runtime_error ("Failed to read jobserver token");
+		}
+
+		if (rc > 0 && (fds[1].revents & POLLIN)) {
+			char wake;
+			if (read (wakeFds[0], &wake, 1) != 1) { }
+		}
+
+		if (rc < 0 && errno != EINTR && errno != EAGAIN)
+			throw runtime_error ("Failed to wait for jobserver token");
+
+		guard.lock ();
+
+#endif
+
+	}
+
+}
+
+void CJobServer::release (int token) {
+
+	unique_lock<mutex> guard (serverLock);
+
+	heldTokens --;
+
+	if (token == IMPLICIT_JOB_TOKEN) {
+
+		implicitFree = true;
+
+#ifndef _MSC_VER
+		if (wakeFds[1] != -1) {
+			char wake = 0;
+			if (write (wakeFds[1], &wake, 1) != 1) { }
+		}
+#endif
+
+	} else if (readFd == -1) {
+
+		localTokens ++;
+
+	} else {
+
+#ifndef _MSC_VER
+		unsigned char byte = (unsigned char) token;
+		while (write (writeFd, &byte, 1) == -1 && errno == EINTR) { }
+#endif
+
+	}
+
+	serverSignal.notify_all ();
+
+}
+
+static bool readLoadAverage (double& load1, int& runnable) {
+
+	ifstream in ("/proc/loadavg");
+	string procs;
+
+	if (!(in >> load1))
+		return false;
+
+	double load5, load15;
+	if (!(in >> load5 >> load15 >> procs))
+		return false;
+
+	runnable = atoi (procs.c_str ());
+	return true;
+
+}
+
+static bool readMemInfo (long& totalKb, long& availableKb) {
+
+	ifstream in ("/proc/meminfo");
+	string key;
+	long value;
+	string unit;
+
+	totalKb = -1;
+	availableKb = -1;
+
+	while (in >> key >> value) {
+		getline (in, unit);
+		if (key == "MemTotal:")
+			totalKb = value;
+		else if (key == "MemAvailable:")
+			availableKb = value;
+	}
+
+	return totalKb > 0 && availableKb >= 0;
+
+}
+
+static bool readPressure (const string& fileName, double& some, double& full) {
+
+	ifstream in (fileName.c_str ());
+	string line;
+	bool found = false;
+
+	some = 0;
+	full = 0;
+
+	while (getline (in, line)) {
+
+		size_t pos = line.find ("avg10=");
+		if (pos == string::npos)
+			continue;
+
+		double value = atof (line.c_str () + pos + 6);
+
+		if (line.compare (0, 4, "some") == 0)
+			some = value;
+		else if (line.compare (0, 4, "full") == 0)
+			full = value;
+
+		found = true;
+
+	}
+
+	return found;
+
+}
+
+CLoadMonitor::CLoadMonitor () {
+	limit = 0;
+	runnableAverage = -1;
+}
+
+void CLoadMonitor::sample (int active) {
+
+	int ceiling = getJobCount ();
+	int cpus = (int) thread::hardware_concurrency ();
+	if (cpus < 1)
+		cpus = 1;
+
+	int target = ceiling;
+	string why;
+
+	auto constrain = [&] (int value, const string& text) {
+		if (value < 1)
+			value = 1;
+		if (value < target) {
+			target = value;
+			why = text;
+		}
+	};
+
+	double load1;
+	int runnable;
+
+	if (readLoadAverage (load1, runnable)) {
+
+		// runnable includes ourselves reading /proc; it is an instant value, so smooth it a bit
+
+		runnable --;
+		runnableAverage = (runnableAverage < 0) ? runnable : (runnableAverage + runnable) / 2;
+		int busy = (int) (runnableAverage + 0.5);
+
+		stringstream ss;
+		if (busy > cpus + max (2, cpus / 2)) {
+			ss << "load: " << busy << " runnable on " << cpus << " CPUs";
+			constrain (active - (busy - cpus), ss.str ());
+		} else if (load1 > 2 * cpus) {
+			ss << "load average " << load1 << " on " << cpus << " CPUs";
+			constrain (active, ss.str ());
+		}
+
+	}
+
+	long totalKb, availableKb;
+
+	if (readMemInfo (totalKb, availableKb)) {
+
+		double percent = 100.0 * availableKb / totalKb;
+
+		stringstream ss;
+		ss << "memory: " << (availableKb / 1024) << " MiB available (" << (int) percent << "%)";
+
+		if (percent < 5)
+			constrain (active / 2, ss.str ());
+		else if (percent < 10)
+			constrain (active, ss.str ());
+
+	}
+
+	double some, full;
+
+	if (readPressure ("/proc/pressure/memory", some, full)) {
+
+		stringstream ss;
+		ss << "memory pressure: some avg10=" << some << " full avg10=" << full;
+
+		if (full > 5)
+			constrain (active / 2, ss.str ());
+		else if (some > 10)
+			constrain (active, ss.str ());
+
+	}
+
+	if (readPressure ("/proc/pressure/cpu", some, full) && some > 80) {
+		stringstream ss;
+		ss << "cpu pressure: some avg10=" << some;
+		constrain (active, ss.str ());
+	}
+
+	int newLimit = target;
+
+	if (limit > 0 && target > limit) {
+
+		// ramp up gradually; the load of what we just started is not visible yet
+
+		newLimit = min (target, limit * 2);
+		why = (target == ceiling) ? "machine is idle" : why;
+
+	}
+
+	int oldLimit = (limit > 0) ? limit : ceiling;
+
+	if (newLimit != oldLimit) {
+		stringstream ss;
+		ss << "lick: job limit " << oldLimit << " -> " << newLimit << " of " << ceiling << " (" << why << ")";
+		console.error (ss.str ());
+	}
+
+	limit = newLimit;
+	reason = why;
+
+}
+
+bool CLoadMonitor::allows (int active) {
+
+	if (getJobCount () <= 1)
+		return active < 1;
+
+	chrono::steady_clock::time_point now = chrono::steady_clock::now ();
+
+	if (limit == 0 || now - lastSample >= chrono::milliseconds (500)) {
+		lastSample = now;
+		sample (active);
+	}
+
+	return active < limit;
+
+}
@@ -0,0 +1,173 @@
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "sys_funcs.h"
+
+using namespace std;
+
+class CJob {
+
+	public:
+
+		int id;
+		thread::id owner;
+		CChildProcess process;
+		int token;
+
+		bool finished;
+		int exitCode;
+
+		thread waiter;
+
+		CJob () {
+			id = 0;
+			token = -1;
+			finished = false;
+			exitCode = -1;
+		}
+
+};
+
+/*
+	Child processes started by spawn (). Each job gets a waiter thread that blocks in
+	finishCommand (), so any number of jobs can be in flight without polling and
+	without reaping children that belong to someone else.
+*/
+
+class CJobTable {
+
+	private:
+
+		mutex tableLock;
+		condition_variable tableSignal;
+
+		map<int,shared_ptr<CJob>> jobs;
+		int nextId;
+
+		void reap (shared_ptr<CJob> job);
+		int collect (shared_ptr<CJob> job);
+
+	public:
+
+		CJobTable ();
+		~CJobTable ();
+
+		int spawn (const list<string>& params, map<string,string>* env);
+
+		int wait (int id);
+		int waitAny (const set<int>& among, int& exitCode);
+		bool waitAll (bool ownOnly);
+
+		// jobs this thread spawned from firstId on, waited for but left to wait () and
+		// waitAll () to collect; tells whether all of them succeeded
+
+		int getNextId ();
+		bool waitFinished (int firstId);
+
+		// whether any job this thread spawned is still running
+
+		bool hasRunning ();
+
+};
+
+extern CJobTable jobTable;
+
+/*
+	Job tokens in the GNU make jobserver sense: a child process may only be started while
+	holding one. lick always owns one implicit token; further tokens come from the jobserver
+	pipe of a parent make (or lick), from a pipe we create ourselves for -j N and hand down to
+	children through MAKEFLAGS, or, on Windows, from a plain in-process counter.
+*/
+
+#define IMPLICIT_JOB_TOKEN (-1)
+
+/*
+	Caps the number of tokens actually used below -j N while the machine is busy: too many
+	runnable threads, little available memory, or PSI pressure in /proc/pressure. The limit
+	drops at once when something is wrong and doubles back towards N once it is fine again.
+	Every change is reported on stderr with its reason. Where /proc is missing nothing is
+	throttled.
+*/
+
+class CLoadMonitor {
+
+	private:
+
+		int limit;
+		string reason;
+		double runnableAverage;
+		chrono::steady_clock::time_point lastSample;
+
+		void sample (int active);
+
+	public:
+
+		CLoadMonitor ();
+
+		bool allows (int active);
+
+};
+
+class CJobServer {
+
+	private:
+
+		mutex serverLock;
+		condition_variable serverSignal;
+
+		bool implicitFree;
+		int localTokens;
+		int heldTokens;
+
+		CLoadMonitor monitor;
+
+		int readFd;
+		int writeFd;
+		int wakeFds[2];
+
+		bool connect (const string& makeflags, int& parentJobs);
+		void create (int jobs);
+
+	public:
+
+		CJobServer ();
+		~CJobServer ();
+
+		void init (bool jobsGiven);
+
+		int acquire ();
+		void release (int token);
+
+};
+
+extern CJobServer jobServer;
+
+class CJobSlot {
+
+	private:
+
+		int token;
+
+	public:
+
+		CJobSlot () {
+			token = jobServer.acquire ();
+		}
+
+		~CJobSlot () {
+			jobServer.release (token);
+		}
+
+};
+
+#endif /* __JOBS_H__ */
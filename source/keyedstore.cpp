@@ -0,0 +1,122 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "keyedstore.h"
+#include "sys_funcs.h"
+#include "console.h"
+
+CKeyedStore::CKeyedStore (const string& p_name, size_t p_maxEntries) {
+
+	name = p_name;
+	maxEntries = p_maxEntries;
+
+	storeOpened = false;
+	storeChanged = false;
+	storeFileName = getStateDirectory ("") + getPathSeparator () + name;
+
+}
+
+void CKeyedStore::setNameFromModule (const string& moduleName) {
+
+	lock_guard<mutex> guard (storeLock);
+
+	if (!storeOpened)
+		storeFileName = getStateDirectory (moduleName) + getPathSeparator () + name;
+
+}
+
+void CKeyedStore::openStore () {
+
+	if (storeOpened)
+		return;
+
+	storeOpened = true;
+
+	ifstream ifs (storeFileName);
+	string line;
+	vector<string> *current = NULL;
+
+	while (getline (ifs, line)) {
+
+		if (line.empty ())
+			continue;
+
+		if (line[0] == '\t') {
+			if (current != NULL)
+				current -> push_back (line.substr (1));
+		} else
+			current = &entries[line];
+
+	}
+
+}
+
+bool CKeyedStore::getLines (const string& key, vector<string>& lines) {
+
+	lock_guard<mutex> guard (storeLock);
+	openStore ();
+
+	map<string,vector<string>>::iterator it = entries.find (key);
+	if (it == entries.end ())
+		return false;
+
+	usedKeys.insert (key);
+	lines = it -> second;
+	return true;
+
+}
+
+void CKeyedStore::setLines (const string& key, const vector<string>& lines) {
+
+	lock_guard<mutex> guard (storeLock);
+	openStore ();
+
+	usedKeys.insert (key);
+
+	map<string,vector<string>>::iterator it = entries.find (key);
+	if (it != entries.end () && it -> second == lines)
+		return;
+
+	entries[key] = lines;
+	storeChanged = true;
+
+}
+
+void CKeyedStore::save () {
+
+	lock_guard<mutex> guard (storeLock);
+
+	if (!storeChanged)
+		return;
+
+	stringstream contents;
+	size_t written = 0;
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (map<string,vector<string>>::iterator it = entries.begin (); it != entries.end (); it++) {
+
+			// entries used by this run first, then others while there is room
+
+			bool used = usedKeys.find (it -> first) != usedKeys.end ();
+			if (used != (pass == 0) || (pass == 1 && written >= maxEntries))
+				continue;
+
+			contents << it -> first << endl;
+			for (size_t i = 0; i < it -> second.size (); i++)
+				contents << "\t" << it -> second[i] << endl;
+			written ++;
+
+		}
+	}
+
+	size_t lastPos = storeFileName.find_last_of (getPathSeparator ());
+	if (lastPos != string::npos)
+		makeDirs (storeFileName.substr (0, lastPos));
+
+	if (!writeFileAtomically (storeFileName, contents.str ()))
+		console.error ("lick: failed to save " + storeFileName);
+
+	storeChanged = false;
+
+}
@@ -0,0 +1,51 @@
+#ifndef __KEYEDSTORE_H__
+#define __KEYEDSTORE_H__
+
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+
+using namespace std;
+
+/*
+	A file in .lick which maps keys to lists of lines, read on first use and rewritten by
+	save () when anything changed. In the file, a key is a line of its own and every line
+	of it follows, starting with a tab. Keys used by this run are always kept, others only
+	up to maxEntries in total, since the keys of most stores change with every edit.
+*/
+
+class CKeyedStore {
+
+	private:
+
+		mutex storeLock;
+		map<string,vector<string>> entries;
+		set<string> usedKeys;
+
+		string name;
+		size_t maxEntries;
+
+		string storeFileName;
+		bool storeOpened;
+		bool storeChanged;
+
+		void openStore ();
+
+	protected:
+
+		bool getLines (const string& key, vector<string>& lines);
+		void setLines (const string& key, const vector<string>& lines);
+
+	public:
+
+		CKeyedStore (const string& p_name, size_t p_maxEntries);
+
+		void setNameFromModule (const string& moduleName);
+
+		void save ();
+
+};
+
+#endif /* __KEYEDSTORE_H__ */
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -11,12 +12,23 @@
 #include "stmt.h"
 #include "module.h"
 #include "hashstore.h"
+#include "threads.h"
+#include "jobs.h"
+#include "history.h"
+#include "filecache.h"
+#include "depfile.h"
+#include "explain.h"
+#include "outputcache.h"
+#include "fingerprint.h"
+#include "console.h"
 
 using namespace std;
 
 void usage () {
 
-	cerr << "Use: lick [-f <input file>] [target [target-args...]]" << endl;
+	cerr << "Use: lick [-f <input file>] [-j <jobs>|auto] [--hash xxh3|sha1] [--dry-run|--explain] [target [target-args...]]" << endl;
+	cerr << "     lick --export-hashstore <text file> | --import-hashstore <text file> | --gc-hashstore" << endl;
+	cerr << "     lick --output-cache-stats <cache dir>" << endl;
 	
 }
 
@@ -24,6 +36,9 @@ int main (int argc, char *argv[]) {
 	
 	string inputFile = "lickable";
 	list<string> params;
+	bool jobsGiven = false;
+	string exportFile, importFile, statsDir;
+	bool collectGarbage = false;
 	
 	for (int i = 1; i < argc; i++) {
 		string arg (argv[i]);
@@ -33,6 +48,55 @@ int main (int argc, char *argv[]) {
 			return 1;
 		}
 		
+		if (arg == "--export-hashstore" || arg == "--import-hashstore") {
+			i++;
+			if (i < argc) {
+				(arg == "--export-hashstore" ? exportFile : importFile) = argv[i];
+				continue;
+			} else {
+				usage ();
+				return 1;
+			}
+		}
+		
+		if (arg == "--output-cache-stats") {
+			i++;
+			if (i < argc) {
+				statsDir = argv[i];
+				continue;
+			} else {
+				usage ();
+				return 1;
+			}
+		}
+		
+		if (arg == "--gc-hashstore") {
+			collectGarbage = true;
+			continue;
+		}
+		
+		if (arg == "--dry-run") {
+			setDryRun (true);
+			continue;
+		}
+		
+		if (arg == "--explain") {
+			setExplain (true);
+			continue;
+		}
+		
+		if (arg == "--hash") {
+			i++;
+			FingerprintAlgorithm algorithm;
+			if (i < argc && CFingerprint::parseAlgorithm (argv[i], algorithm)) {
+				CFingerprint::setAlgorithm (algorithm);
+				continue;
+			} else {
+				usage ();
+				return 1;
+			}
+		}
+		
 		if (arg == "-f") {
 			i++;
 			if (i < argc) {
@@ -41,11 +105,56 @@ int main (int argc, char *argv[]) {
 				usage ();
 				return 1;
 			}
+		} else if (arg.substr (0, 2) == "-j") {
+			string jobs = arg.substr (2);
+			if (jobs.empty ()) {
+				i++;
+				if (i < argc) {
+					jobs = argv[i];
+				} else {
+					usage ();
+					return 1;
+				}
+			}
+			// "auto" leaves headroom for I/O-bound jobs; the load monitor trims it when the machine is busy
+			int jobCount = (jobs == "auto") ? 2 * max (1, (int) thread::hardware_concurrency ()) : atoi (jobs.c_str ());
+			if (jobCount < 1) {
+				usage ();
+				return 1;
+			}
+			setJobCount (jobCount);
+			jobsGiven = true;
 		} else
 			params.push_back (arg);
 		
 	}
 	
+	if (!statsDir.empty ()) {
+		COutputCache::printStats (getAbsolutePath (makeSysSeparators (statsDir)), cout);
+		return 0;
+	}
+	
+	jobServer.init (jobsGiven);
+	console.init ();
+
+	CHoldInterpreter interpreter;
+	CHashStoreFlusher flusher;
+	
+	if (!exportFile.empty () || !importFile.empty () || collectGarbage) {
+		try {
+			if (!importFile.empty ())
+				hashStore.importText (importFile);
+			if (collectGarbage)
+				hashStore.collectGarbage ();
+			if (!exportFile.empty ())
+				hashStore.exportText (exportFile);
+		} catch (exception& e) {
+			console.error (e.what ());
+			return 1;
+		}
+		return 0;
+	}
+	
 	try {
 
 		CLineCountedInputFile input (inputFile);
@@ -93,8 +202,26 @@ int main (int argc, char *argv[]) {
 		if (!willExecuteTarget.empty ()) {
 			module.executeTarget (ctx, willExecuteTarget, willExecuteParams);
 		}
+		
+		if (!jobTable.waitAll (false))
+			throw runtime_error ("Command exec failed");
+		
+		if (!getDryRun ())
+			durationHistory.save ();
+		fileCache.save ();
+		depfileStore.save ();
+		componentStore.save ();
+		outputCache.save ();
+		console.finish ();
 			
 	} catch (exception& e) {
+		if (!getDryRun ())
+			durationHistory.save ();
+		fileCache.save ();
+		depfileStore.save ();
+		componentStore.save ();
+		outputCache.save ();
+		console.finish ();
 		cerr << e.what () << endl;
 		return 1;
 	}
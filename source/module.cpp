@@ -1,5 +1,9 @@
 #include "module.h"
 #include "hashstore.h"
+#include "threads.h"
+#include "jobs.h"
+#include "history.h"
+#include "filecache.h"
 
 CModule::CModule (CInputParser& parser) {
 
@@ -41,8 +45,70 @@ CModule::CModule (CInputParser& parser) {
 					throw ESyntaxError (parser, "Expected , or )");
 			}
 			
+			list<string> prerequisites;
+			double weight = 0;
+			
+			while (true) {
+				
+				next = parser.getToken ();
+				
+				if (next.getValue () == "requires") {
+					
+					if (token.getValue () != "target")
+						throw ESyntaxError (parser, "Only targets can have prerequisites");
+					
+					next = parser.getToken ();
+					if (next.getValue () != "(")
+						throw ESyntaxError (parser, "Expected (");
+					
+					while (true) {
+						
+						next = parser.getToken ();
+						if (next.getValue () == ")")
+							break;
+						
+						if (next.getTokenType() != NameToken)
+							throw ESyntaxError (parser, "Expected target name");
+						
+						prerequisites.push_back (next.getValue ());
+						
+						next = parser.getToken ();
+						if (next.getValue () == ")")
+							break;
+						else if (next.getValue () != ",")
+							throw ESyntaxError (parser, "Expected , or )");
+					}
+					
+				} else if (next.getValue () == "weight") {
+					
+					// estimated duration in seconds, used for scheduling until there is history
+					
+					if (token.getValue () != "target")
+						throw ESyntaxError (parser, "Only targets can have a weight");
+					
+					next = parser.getToken ();
+					if (next.getValue () != "(")
+						throw ESyntaxError (parser, "Expected (");
+					
+					next = parser.getToken ();
+					if (next.getTokenType () != NumLiteral)
+						throw ESyntaxError (parser, "Expected number");
+					
+					weight = atof (next.getValue ().c_str ());
+					
+					next = parser.getToken ();
+					if (next.getValue () != ")")
+						throw ESyntaxError (parser, "Expected )");
+					
+				} else {
+					parser.pushBack (next);
+					break;
+				}
+				
+			}
+			
 			shared_ptr<CStatement> stmt = CStatement::parse (parser);
-			shared_ptr<CUserFunction> userFunc (new CUserFunction (functionName, args, stmt, (token.getValue() == "target")));
+			shared_ptr<CUserFunction> userFunc (new CUserFunction (functionName, args, prerequisites, weight, stmt, (token.getValue() == "target")));
 
 			addUserFunction (functionName, userFunc);
 			if (token.getValue () == "target")
@@ -105,21 +171,195 @@ shared_ptr<CValue> CModule::executeTarget (shared_ptr<CExecutionContext> ctx, co
 	
 	shared_ptr<CUserFunction> func = f_it -> second;
 	
+	if (!func -> getPrerequisites ().empty ())
+		executePrerequisites (ctx, targetName);
+	
 	vector<shared_ptr<CExpression>> invoke_args;
 	for (list<string>::const_iterator it = params.begin (); it != params.end (); it++) {
 		shared_ptr<CExpression> arg = shared_ptr<CExpression> (new CConstantExpression (shared_ptr<CValue> (new CStringValue (*it))));
 		invoke_args.push_back (arg);
 	}
 	
-	shared_ptr<CValue> retValue = func -> execute (ctx, invoke_args);
+	shared_ptr<CValue> retValue;
 	
-	if (targetName == "clean") 
+	{
+		CDurationTimer timer (getTargetKey (ctx, targetName));
+		
+		retValue = func -> execute (ctx, invoke_args);
+		
+		bool succeeded = jobTable.waitAll (true);
+		fileCache.invalidateAll ();
+		if (!succeeded)
+			throw runtime_error ("Command exec failed");
+	}
+	
+	// a dry run leaves the hash store as it is, for clean too
+	
+	if (targetName == "clean" && !getDryRun ())
 		hashStore.clear (ctx -> getCurModule ());
 	
+	hashStore.flush ();
+	
 	return retValue;
 	
 }
 
+void CModule::collectPrerequisites (shared_ptr<CExecutionContext> ctx, const string& targetName, map<string,list<string>>& graph, set<string>& visiting) {
+
+	shared_ptr<CUserFunction> func = ctx -> getBaseContext () -> getFunction (targetName);
+	const list<string>& prerequisites = func -> getPrerequisites ();
+	
+	visiting.insert (targetName);
+	
+	for (list<string>::const_iterator it = prerequisites.begin (); it != prerequisites.end (); it++) {
+		
+		if (visiting.find (*it) != visiting.end ())
+			throw runtime_error ("Circular prerequisite: " + targetName + " requires " + (*it));
+		
+		shared_ptr<CUserFunction> prereq;
+		try {
+			prereq = ctx -> getBaseContext () -> getFunction (*it);
+		} catch (exception& e) {
+			prereq = shared_ptr<CUserFunction> ();
+		}
+		
+		if (!prereq || !prereq -> isTargetFunction ())
+			throw runtime_error ("Target " + (*it) + " required by " + targetName + " is not defined.");
+		
+		if (graph.find (*it) == graph.end ())
+			collectPrerequisites (ctx, *it, graph, visiting);
+		
+	}
+	
+	visiting.erase (targetName);
+	graph[targetName] = list<string> (prerequisites.begin (), prerequisites.end ());
+	
+}
+
+void CModule::executePrerequisites (shared_ptr<CExecutionContext> ctx, const string& targetName) {
+
+	map<string,list<string>> graph;
+	set<string> visiting;
+	
+	collectPrerequisites (ctx, targetName, graph, visiting);
+	
+	// the requested target itself runs on the calling thread, with its params
+	
+	graph.erase (targetName);
+	if (graph.empty ())
+		return;
+	
+	map<string,int> waitingFor;
+	map<string,list<string>> dependents;
+	
+	for (map<string,list<string>>::iterator it = graph.begin (); it != graph.end (); it++) {
+		set<string> unique (it -> second.begin (), it -> second.end ());
+		waitingFor[it -> first] = unique.size ();
+		for (set<string>::iterator i1 = unique.begin (); i1 != unique.end (); i1++)
+			dependents[*i1].push_back (it -> first);
+	}
+	
+	// longest remaining chain (own duration plus the longest chain of anything waiting for it) starts first
+	
+	map<string,double> chain;
+	
+	function<double(const string&)> chainLength = [&] (const string& name) -> double {
+		
+		map<string,double>::iterator known = chain.find (name);
+		if (known != chain.end ())
+			return known -> second;
+		
+		double longest = 0;
+		list<string>& next = dependents[name];
+		for (list<string>::iterator it = next.begin (); it != next.end (); it++) {
+			if (graph.find (*it) != graph.end ())
+				longest = max (longest, chainLength (*it));
+		}
+		
+		return chain[name] = getTargetEstimate (ctx, name) + longest;
+		
+	};
+	
+	for (map<string,list<string>>::iterator it = graph.begin (); it != graph.end (); it++)
+		chainLength (it -> first);
+	
+	int threadCount = min (getJobCount (), (int) graph.size ());
+	CWorkerPool pool (threadCount);
+	
+	// scheduler state is only touched while holding the interpreter lock; every task
+	// submitted runs whichever ready target is most critical at that moment
+	
+	vector<string> ready;
+	
+	function<void()> runNext = [&] () {
+		
+		CHoldInterpreter interpreter;
+		
+		if (pool.failed ())
+			return;
+		
+		vector<string>::iterator best = ready.begin ();
+		for (vector<string>::iterator it = ready.begin (); it != ready.end (); it++) {
+			if (chain[*it] > chain[*best])
+				best = it;
+		}
+		
+		string name = *best;
+		ready.erase (best);
+		
+		{
+			CDurationTimer timer (getTargetKey (ctx, name));
+			
+			shared_ptr<CUserFunction> func = ctx -> getBaseContext () -> getFunction (name);
+			func -> execute (ctx, vector<shared_ptr<CExpression>> ());
+			
+			bool succeeded = jobTable.waitAll (true);
+			fileCache.invalidateAll ();
+			if (!succeeded)
+				throw runtime_error ("Command exec failed");
+		}
+		
+		hashStore.flush ();
+		
+		list<string>& next = dependents[name];
+		for (list<string>::iterator it = next.begin (); it != next.end (); it++) {
+			if (--waitingFor[*it] == 0 && graph.find (*it) != graph.end ()) {
+				ready.push_back (*it);
+				pool.submit (runNext);
+			}
+		}
+		
+	};
+	
+	for (map<string,int>::iterator it = waitingFor.begin (); it != waitingFor.end (); it++) {
+		if (it -> second == 0)
+			ready.push_back (it -> first);
+	}
+	
+	for (size_t i = 0; i < ready.size (); i++)
+		pool.submit (runNext);
+	
+	pool.wait ();
+	
+}
+
+string CModule::getTargetKey (shared_ptr<CExecutionContext> ctx, const string& targetName) {
+	return "target:" + ctx -> getCurModule () + ":" + targetName;
+}
+
+double CModule::getTargetEstimate (shared_ptr<CExecutionContext> ctx, const string& targetName) {
+
+	double seconds;
+	if (durationHistory.getDuration (getTargetKey (ctx, targetName), seconds))
+		return seconds;
+	
+	// no history yet: the weight hint, or an arbitrary unit so that longer chains still win
+	
+	double weight = ctx -> getBaseContext () -> getFunction (targetName) -> getWeight ();
+	return (weight > 0) ? weight : 1;
+
+}
+
 void CModule::listTargets () {
 	for (list<string>::iterator it = targets.begin (); it != targets.end (); it++)
 		cout << (*it) << endl;
@@ -4,6 +4,7 @@
 #include <list>
 #include <string>
 #include <map>
+#include <set>
 #include <memory>
 #include <stdexcept>
 
@@ -30,6 +31,12 @@ class CModule {
 			userFunctions.insert (pair<string,shared_ptr<CUserFunction>> (name, func));
 		}
 		
+		void collectPrerequisites (shared_ptr<CExecutionContext> ctx, const string& targetName, map<string,list<string>>& graph, set<string>& visiting);
+		void executePrerequisites (shared_ptr<CExecutionContext> ctx, const string& targetName);
+		
+		static string getTargetKey (shared_ptr<CExecutionContext> ctx, const string& targetName);
+		static double getTargetEstimate (shared_ptr<CExecutionContext> ctx, const string& targetName);
+		
 	public:
 		
 		CModule (CInputParser& parser);
@@ -0,0 +1,433 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <list>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#include "outputcache.h"
+#include "fingerprint.h"
+#include "filecache.h"
+#include "sys_funcs.h"
+#include "console.h"
+
+COutputCache outputCache;
+
+COutputCache::COutputCache () {
+
+	maxSize = (uint64_t) OUTPUT_CACHE_DEFAULT_SIZE << 20;
+	tempCounter = 0;
+	hits = 0;
+	misses = 0;
+	stores = 0;
+	storedSize = 0;
+
+}
+
+void COutputCache::setDirectory (const string& dir, uint64_t maxSizeMB) {
+
+	lock_guard<mutex> guard (cacheLock);
+
+	cacheDir = dir;
+	maxSize = maxSizeMB << 20;
+
+}
+
+/*
+	setDirectory runs under the interpreter lock while restore, store and detach run in
+	threads which have released it, so they take a copy of the directory first.
+*/
+
+string COutputCache::getDirectory () {
+
+	lock_guard<mutex> guard (cacheLock);
+	return cacheDir;
+
+}
+
+string COutputCache::getEntryDir (const string& dir, const string& key) {
+
+	return dir + getPathSeparator () + key.substr (0, 2) + getPathSeparator () + key;
+
+}
+
+bool COutputCache::getFileDigest (const string& fileName, string& digest) {
+
+	ifstream ifs (fileName, ios::binary);
+	if (!ifs.is_open ())
+		return false;
+
+	shared_ptr<CFingerprint> hash = CFingerprint::create ();
+	hash -> update (ifs);
+	digest = hash -> final ();
+
+	return true;
+
+}
+
+/*
+	Entries of one key differ in the inputs their depfile named, say one per state of a
+	header; each is a directory of its own under the key's, named by a hash of those inputs.
+*/
+
+bool COutputCache::restoreVariant (const string& dir, const string& variantDir, const vector<string>& outputs, vector<string>& inputs) {
+
+	vector<string> outputDigests;
+	vector<string> inputNames;
+
+	ifstream ifs (variantDir + getPathSeparator () + "manifest");
+	string line;
+
+	while (getline (ifs, line)) {
+
+		size_t pos = line.find ('\t');
+		if (pos == string::npos)
+			continue;
+
+		string kind = line.substr (0, pos);
+		string rest = line.substr (pos + 1);
+
+		if (kind == "output")
+			outputDigests.push_back (rest);
+		else if (kind == "input") {
+
+			// an input the depfile named must be as it was when the entry was stored
+
+			size_t namePos = rest.find ('\t');
+			string digest;
+			if (namePos == string::npos || !fileCache.getDigest (rest.substr (namePos + 1), digest) || digest != rest.substr (0, namePos))
+				return false;
+
+			inputNames.push_back (rest.substr (namePos + 1));
+
+		}
+
+	}
+
+	if (outputDigests.empty () || outputDigests.size () != outputs.size ())
+		return false;
+
+	// a file written into in place through a hard link changes the entry too, which is
+	// dropped then
+
+	for (size_t i = 0; i < outputs.size (); i++) {
+
+		stringstream ss;
+		ss << variantDir << getPathSeparator () << i;
+
+		string digest;
+		if (!getFileDigest (ss.str (), digest) || digest != outputDigests[i]) {
+			try {
+				deleteFileOrDir (variantDir);
+			} catch (exception& e) {
+			}
+			return false;
+		}
+
+	}
+
+	for (size_t i = 0; i < outputs.size (); i++) {
+
+		stringstream ss;
+		ss << variantDir << getPathSeparator () << i;
+
+		size_t lastPos = outputs[i].find_last_of (getPathSeparator ());
+		if (lastPos != string::npos)
+			makeDirs (outputs[i].substr (0, lastPos));
+
+		bool restored = false;
+
+		try {
+			deleteFileOrDir (outputs[i]);
+			restored = cloneFile (ss.str (), outputs[i], true);
+		} catch (exception& e) {
+		}
+
+		fileCache.invalidate (outputs[i]);
+
+		if (!restored) {
+			console.error ("lick: failed to restore " + outputs[i] + " from " + dir);
+			return false;
+		}
+
+	}
+
+	touchFile (variantDir + getPathSeparator () + "manifest");
+	inputs = inputNames;
+
+	return true;
+
+}
+
+bool COutputCache::restore (const string& key, const vector<string>& outputs, vector<string>& inputs) {
+
+	string dir = getDirectory ();
+	string entryDir = getEntryDir (dir, key);
+	bool restored = false;
+
+	if (isDirectory (entryDir)) {
+
+		list<string> files = getFilesInPath (entryDir);
+
+		// names come back prefixed with entryDir and a slash
+
+		for (list<string>::iterator it = files.begin (); !restored && it != files.end (); it++) {
+			string name = it -> substr (entryDir.length () + 1);
+			size_t pos = name.find ('/');
+			if (pos != string::npos && name.substr (pos + 1) == "manifest")
+				restored = restoreVariant (dir, entryDir + getPathSeparator () + name.substr (0, pos), outputs, inputs);
+		}
+
+	}
+
+	lock_guard<mutex> guard (cacheLock);
+	(restored ? hits : misses) ++;
+
+	return restored;
+
+}
+
+void COutputCache::store (const string& key, const vector<string>& outputs, const vector<string>& inputs) {
+
+	// only regular files are kept, and only when every input the depfile named can be read
+
+	for (size_t i = 0; i < outputs.size (); i++) {
+		CFileStat fileStat;
+		if (!getFileStat (outputs[i], fileStat) || fileStat.directory)
+			return;
+	}
+
+	stringstream manifest;
+
+	for (size_t i = 0; i < inputs.size (); i++) {
+		string digest;
+		if (!fileCache.getDigest (inputs[i], digest))
+			return;
+		manifest << "input\t" << digest << "\t" << inputs[i] << endl;
+	}
+
+	shared_ptr<CFingerprint> variant = CFingerprint::create ();
+	variant -> update (manifest.str ());
+
+	string dir;
+	stringstream ss;
+	{
+		lock_guard<mutex> guard (cacheLock);
+		dir = cacheDir;
+		ss << dir << getPathSeparator () << "tmp" << getPathSeparator () << key << "." << chrono::system_clock::now ().time_since_epoch ().count () << "." << (tempCounter++);
+	}
+
+	string tempDir = ss.str ();
+	makeDirs (tempDir);
+
+	uint64_t size = 0;
+	bool ok = true;
+
+	for (size_t i = 0; ok && i < outputs.size (); i++) {
+
+		stringstream name;
+		name << tempDir << getPathSeparator () << i;
+
+		CFileStat fileStat;
+		string digest;
+
+		ok = cloneFile (outputs[i], name.str (), false) && getFileDigest (name.str (), digest) && getFileStat (name.str (), fileStat);
+
+		manifest << "output\t" << digest << endl;
+		size += fileStat.size;
+
+	}
+
+	string entryDir = getEntryDir (dir, key) + getPathSeparator () + variant -> final ();
+
+	if (ok) {
+
+		ofstream ofs (tempDir + getPathSeparator () + "manifest");
+		ofs << manifest.str ();
+		ofs.close ();
+
+		makeDirs (entryDir.substr (0, entryDir.find_last_of (getPathSeparator ())));
+
+		try {
+			deleteFileOrDir (entryDir);
+		} catch (exception& e) {
+		}
+
+		ok = !ofs.fail () && replaceFile (tempDir, entryDir);
+
+	}
+
+	if (!ok) {
+		try {
+			deleteFileOrDir (tempDir);
+		} catch (exception& e) {
+		}
+		return;
+	}
+
+	lock_guard<mutex> guard (cacheLock);
+	stores ++;
+	storedSize += size;
+
+}
+
+void COutputCache::detach (const vector<string>& outputs) {
+
+	string dir = getDirectory ();
+
+	for (size_t i = 0; i < outputs.size (); i++) {
+
+		if (getLinkCount (outputs[i]) < 2)
+			continue;
+
+		string tempName = outputs[i] + ".detach";
+
+		try {
+			deleteFileOrDir (tempName);
+			copyFile (outputs[i], tempName);
+			if (!replaceFile (tempName, outputs[i]))
+				deleteFileOrDir (outputs[i]);
+		} catch (exception& e) {
+			console.error ("lick: failed to detach " + outputs[i] + " from " + dir + ": " + e.what ());
+		}
+
+		fileCache.invalidate (outputs[i]);
+
+	}
+
+}
+
+void COutputCache::readStats (const string& dir, map<string,uint64_t>& stats) {
+
+	ifstream ifs (dir + getPathSeparator () + "stats");
+	string name;
+	uint64_t value;
+
+	while (ifs >> name >> value)
+		stats[name] = value;
+
+}
+
+/*
+	Sizes up every entry and removes the least recently used ones until the cache is below
+	OUTPUT_CACHE_EVICT_PERCENT of its size; returns what remains. Leftovers of stores that
+	never finished, in <dir>/tmp, are entries like any other and go by their age.
+*/
+
+uint64_t COutputCache::evict (uint64_t& evictions) {
+
+	map<string,pair<uint64_t,uint64_t>> entries;
+
+	list<string> files = getFilesInPath (cacheDir);
+
+	for (list<string>::iterator it = files.begin (); it != files.end (); it++) {
+
+		// an entry is the directory a file is in; the stats and the lock are in none
+
+		string name = it -> substr (cacheDir.length () + 1);
+		size_t pos = name.find_last_of ('/');
+		if (pos == string::npos)
+			continue;
+
+		CFileStat fileStat;
+		if (!getFileStat (makeSysSeparators (*it), fileStat))
+			continue;
+
+		pair<uint64_t,uint64_t>& info = entries[name.substr (0, pos)];
+		info.second += fileStat.size;
+		info.first = max (info.first, fileStat.mtimeNs);
+
+	}
+
+	uint64_t total = 0;
+	vector<pair<uint64_t,string>> byAge;
+
+	for (map<string,pair<uint64_t,uint64_t>>::iterator it = entries.begin (); it != entries.end (); it++) {
+		total += it -> second.second;
+		byAge.push_back (pair<uint64_t,string> (it -> second.first, it -> first));
+	}
+
+	sort (byAge.begin (), byAge.end ());
+
+	uint64_t target = maxSize / 100 * OUTPUT_CACHE_EVICT_PERCENT;
+
+	for (size_t i = 0; i < byAge.size () && total > target; i++) {
+
+		try {
+			deleteFileOrDir (cacheDir + getPathSeparator () + makeSysSeparators (byAge[i].second));
+		} catch (exception& e) {
+			continue;
+		}
+
+		total -= entries[byAge[i].second].second;
+		evictions ++;
+
+	}
+
+	return total;
+
+}
+
+void COutputCache::save () {
+
+	lock_guard<mutex> guard (cacheLock);
+
+	if (cacheDir.empty () || hits + misses + stores == 0)
+		return;
+
+	makeDirs (cacheDir);
+
+	// several licks may share the cache, the stats are updated by one at a time
+
+	CFileLock fileLock;
+	if (fileLock.open (cacheDir + getPathSeparator () + "lock"))
+		fileLock.lock (true, true);
+
+	map<string,uint64_t> stats;
+	readStats (cacheDir, stats);
+
+	stats["hits"] += hits;
+	stats["misses"] += misses;
+	stats["stores"] += stores;
+	stats["size"] += storedSize;
+
+	if (stats["size"] > maxSize)
+		stats["size"] = evict (stats["evictions"]);
+
+	stringstream contents;
+	for (map<string,uint64_t>::iterator it = stats.begin (); it != stats.end (); it++)
+		contents << it -> first << " " << it -> second << endl;
+
+	if (!writeFileAtomically (cacheDir + getPathSeparator () + "stats", contents.str ()))
+		console.error ("lick: failed to save " + cacheDir + getPathSeparator () + "stats");
+
+	stringstream ss;
+	ss << "output cache: " << hits << " restored, " << misses << " not found, " << stores << " stored" << endl;
+	console.write (ss.str ());
+
+	hits = 0;
+	misses = 0;
+	stores = 0;
+	storedSize = 0;
+
+}
+
+void COutputCache::printStats (const string& dir, ostream& os) {
+
+	map<string,uint64_t> stats;
+	readStats (dir, stats);
+
+	uint64_t lookups = stats["hits"] + stats["misses"];
+
+	os << "output cache " << dir << endl;
+	os << "  hits       " << stats["hits"];
+	if (lookups > 0)
+		os << " (" << (stats["hits"] * 100 / lookups) << "%)";
+	os << endl;
+	os << "  misses     " << stats["misses"] << endl;
+	os << "  stores     " << stats["stores"] << endl;
+	os << "  evictions  " << stats["evictions"] << endl;
+	os << "  size       " << fixed << setprecision (1) << (stats["size"] / 1048576.0) << " MB" << endl;
+
+}
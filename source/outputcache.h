@@ -0,0 +1,76 @@
+#ifndef __OUTPUTCACHE_H__
+#define __OUTPUTCACHE_H__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+
+using namespace std;
+
+/*
+	Outputs of depends blocks, kept in a directory given by sys.output_cache and shared by
+	every lickable which names it. An entry is keyed by the contents of the block's listed
+	inputs, the names of its outputs and its action, so it is found again after a branch
+	switch or in a clean checkout, where the hash store has nothing. <dir>/<xx>/<key>/<v>/
+	holds the outputs as 0, 1, ... and a manifest with their digests and the digests of the
+	inputs a depfile named, one such directory below the key's for every set of those.
+	<dir>/stats keeps the counters and the total size. A used entry is touched, and once
+	the cache outgrows sys.output_cache_size (in MB) the entries used least recently go
+	until it is down to OUTPUT_CACHE_EVICT_PERCENT of that.
+*/
+
+#define OUTPUT_CACHE_DEFAULT_SIZE 5120
+#define OUTPUT_CACHE_EVICT_PERCENT 90
+
+class COutputCache {
+
+	private:
+
+		mutex cacheLock;
+
+		string cacheDir;
+		uint64_t maxSize;
+		int tempCounter;
+
+		// counts of this run, added to <dir>/stats by save ()
+
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t stores;
+		uint64_t storedSize;
+
+		string getDirectory ();
+		bool restoreVariant (const string& dir, const string& variantDir, const vector<string>& outputs, vector<string>& inputs);
+		uint64_t evict (uint64_t& evictions);
+
+		static string getEntryDir (const string& dir, const string& key);
+		static bool getFileDigest (const string& fileName, string& digest);
+		static void readStats (const string& dir, map<string,uint64_t>& stats);
+
+	public:
+
+		COutputCache ();
+
+		void setDirectory (const string& dir, uint64_t maxSizeMB);
+
+		// outputs and inputs are absolute names; restore gives back the inputs the depfile named
+
+		bool restore (const string& key, const vector<string>& outputs, vector<string>& inputs);
+		void store (const string& key, const vector<string>& outputs, const vector<string>& inputs);
+
+		// outputs restored as hard links get files of their own, before an action writes into them
+
+		void detach (const vector<string>& outputs);
+
+		void save ();
+
+		static void printStats (const string& dir, ostream& os);
+
+};
+
+extern COutputCache outputCache;
+
+#endif /* __OUTPUTCACHE_H__ */
@@ -1,10 +1,19 @@
 #include <stdexcept>
+#include <algorithm>
 
 #include "module.h"
-#include "sha1.h"
+#include "fingerprint.h"
 #include "hashstore.h"
 #include "sys_funcs.h"
 #include "stmt.h"
+#include "threads.h"
+#include "jobs.h"
+#include "history.h"
+#include "filecache.h"
+#include "depfile.h"
+#include "explain.h"
+#include "console.h"
+#include "outputcache.h"
 
 shared_ptr<CStatement> CStatement::parse (CInputParser& parser) {
 	
@@ -19,6 +28,13 @@ shared_ptr<CStatement> CStatement::parse (CInputParser& parser) {
 	if (token.getValue () == "for" || token.getValue () == "while")
 		return shared_ptr<CStatement> (new CForStatement (token.getValue (), parser));
 
+	if (token.getValue () == "parallel") {
+		CToken next = parser.getToken ();
+		if (next.getValue () == "for")
+			return shared_ptr<CStatement> (new CForStatement (next.getValue (), parser, true));
+		parser.pushBack (next);
+	}
+
 	if (token.getValue () == "break")
 		return shared_ptr<CStatement> (new CBreakStatement (parser));
 	
@@ -57,8 +73,14 @@ CStatement::CStatement (CInputParser& parser) {
 
 void CStatement::execute (shared_ptr<CExecutionContext> ctx) {
 	
+	withLocation ([&] () { executeThrow (ctx); });
+	
+}
+
+void CStatement::withLocation (function<void()> action) {
+	
 	try {
-		executeThrow (ctx);
+		action ();
 	} catch (EExecutionError& e) {
 		throw;
 	} catch (exception& e) {
@@ -67,7 +89,15 @@ void CStatement::execute (shared_ptr<CExecutionContext> ctx) {
 	
 }
 
-void CStatement::updateHash (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+string CStatement::getLocation () {
+
+	stringstream ss;
+	ss << (*fileName) << ":" << (lineNumber+1);
+	return ss.str ();
+
+}
+
+void CStatement::updateHash (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 
 	if (this == NULL)
 		hash.update ("null");
@@ -87,7 +117,7 @@ void CExprStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 	expr -> evaluate (ctx);
 }
 
-void CExprStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CExprStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	expr -> updateHash (ctx, hash);
 }
 
@@ -107,7 +137,7 @@ CCompoundStatement::CCompoundStatement (CInputParser& parser): CStatement (parse
 	
 }
 
-void CCompoundStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CCompoundStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 
 	for (list<shared_ptr<CStatement>>::iterator it = stmts.begin(); it != stmts.end (); it++)
 		(*it) -> updateHash (ctx, hash);
@@ -118,8 +148,33 @@ void CCompoundStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 
 	string oldCwd = getCurrentDirectory ();
 	
-	for (list<shared_ptr<CStatement>>::iterator it = stmts.begin(); it != stmts.end (); it++) {
-		(*it) -> execute (ctx);
+	list<shared_ptr<CStatement>>::iterator it = stmts.begin();
+	
+	while (it != stmts.end ()) {
+		
+		// consecutive depends blocks are fingerprinted together
+		
+		vector<CDependsStatement *> batch;
+		while (it != stmts.end ()) {
+			CDependsStatement *depends = dynamic_cast<CDependsStatement *> (it -> get ());
+			if (depends == NULL)
+				break;
+			batch.push_back (depends);
+			it++;
+		}
+		
+		if (batch.size () > 1) {
+			vector<CDependsFingerprint> fingerprints;
+			for (size_t i = 0; i < batch.size (); i++)
+				fingerprints.push_back (CDependsFingerprint (batch[i]));
+			CDependsStatement::executeBatch (ctx, fingerprints);
+		} else if (batch.size () == 1)
+			batch[0] -> execute (ctx);
+		else {
+			(*it) -> execute (ctx);
+			it++;
+		}
+		
 		if (ctx -> breakSignaled || ctx -> continueSignaled || ctx -> returnSignaled)
 			break;
 	}
@@ -130,6 +185,42 @@ void CCompoundStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 	
 }
 
+bool CCompoundStatement::getDependsBlocks (vector<CDependsStatement *>& blocks) {
+
+	for (list<shared_ptr<CStatement>>::iterator it = stmts.begin (); it != stmts.end (); it++) {
+		CDependsStatement *depends = dynamic_cast<CDependsStatement *> (it -> get ());
+		if (depends == NULL)
+			return false;
+		blocks.push_back (depends);
+	}
+	
+	return !blocks.empty ();
+
+}
+
+static bool dryRun = false;
+static bool explain = false;
+
+// declared outputs of blocks a dry run found out of date, for the blocks using them
+
+static set<string> pendingOutputs;
+
+void setDryRun (bool p_dryRun) {
+	dryRun = p_dryRun;
+}
+
+bool getDryRun () {
+	return dryRun;
+}
+
+void setExplain (bool p_explain) {
+	explain = p_explain;
+}
+
+bool getExplain () {
+	return explain;
+}
+
 CDependsStatement::CDependsStatement (CInputParser& parser): CStatement (parser)  {
 
 	CToken token = parser.getToken ();
@@ -138,69 +229,642 @@ CDependsStatement::CDependsStatement (CInputParser& parser): CStatement (parser)
 	
 	expr = CExpression::parse (parser, 0);
 	
+	// options follow the inputs: depends (srcs, depfile: "obj/x.d")
+	
 	token = parser.getToken ();
+	while (token.getValue () == ",") {
+		
+		CToken name = parser.getToken ();
+		if (name.getTokenType () != NameToken)
+			throw ESyntaxError (parser, "Expected option name");
+		
+		token = parser.getToken ();
+		if (token.getValue () != ":")
+			throw ESyntaxError (parser, "Expected :");
+		
+		if (name.getValue () == "depfile")
+			depfileExpr = CExpression::parse (parser, 0);
+		else
+			throw ESyntaxError (parser, "Unknown depends option " + name.getValue ());
+		
+		token = parser.getToken ();
+		
+	}
+	
 	if (token.getValue () != ")")
 		throw ESyntaxError (parser, "Expected )");
 	
+	token = parser.getToken ();
+	if (token.getTokenType () == NameToken && token.getValue () == "produces") {
+		
+		token = parser.getToken ();
+		if (token.getValue () != "(")
+			throw ESyntaxError (parser, "Expected (");
+		
+		producesExpr = CExpression::parse (parser, 0);
+		
+		token = parser.getToken ();
+		if (token.getValue () != ")")
+			throw ESyntaxError (parser, "Expected )");
+		
+	} else
+		parser.pushBack (token);
+	
 	actionStmt = CStatement::parse (parser);
 	
 }
 
-void CDependsStatement::updateFileHash (SHA1& hash, const string& fileName) {
+string CDependsStatement::getAbsoluteName (const string& baseDirectory, const string& fileName) {
+
+	// runs without the interpreter lock, so must not depend on the current directory
+	
+	string sysName = makeSysSeparators (fileName);
+	return getAbsolutePath (isAbsolutePath (sysName) ? sysName : (baseDirectory + getPathSeparator () + sysName));
+
+}
+
+/*
+	An input the depfile names may be a listed one again, absolute where the block listed it
+	relative; such names are compared by their absolute form with "." and ".." taken out, as
+	text, since resolving links for every header of every block would cost a stat each.
+*/
 
-	string absName = getAbsolutePath (fileName);
+static string getLexicalPath (const string& baseDirectory, const string& fileName) {
 
-	hash.update ("[name:[");
-	hash.update (absName);
-	hash.update ("]");
+	string separator = getPathSeparator ();
+	string name = makeSysSeparators (fileName);
+	if (!isAbsolutePath (name))
+		name = baseDirectory + separator + name;
+
+	vector<string> parts;
+	size_t start = 0;
+
+	while (start <= name.length ()) {
+
+		size_t end = name.find (separator, start);
+		if (end == string::npos)
+			end = name.length ();
+
+		string part = name.substr (start, end - start);
+		if (part == "..") {
+			if (!parts.empty ())
+				parts.pop_back ();
+		} else if (!part.empty () && part != ".")
+			parts.push_back (part);
+
+		start = end + separator.length ();
+
+	}
+
+	string result = name.compare (0, separator.length (), separator) == 0 ? separator : "";
+	for (size_t i = 0; i < parts.size (); i++)
+		result += (i > 0 ? separator : "") + parts[i];
+
+	return result;
+
+}
+
+void CDependsStatement::addDiscoveredInputs (CDependsFingerprint& fingerprint, const vector<string>& discovered) {
+
+	set<string> known;
+	for (size_t i = 0; i < fingerprint.files.size (); i++)
+		known.insert (getLexicalPath (fingerprint.baseDirectory, fingerprint.files[i]));
+
+	for (size_t i = 0; i < discovered.size (); i++) {
+		if (known.insert (getLexicalPath (fingerprint.baseDirectory, discovered[i])).second)
+			fingerprint.files.push_back (discovered[i]);
+	}
+
+}
+
+string CDependsStatement::getFileFingerprint (const string& baseDirectory, const string& fileName, bool contentHash) {
+
+	string absName = getAbsoluteName (baseDirectory, fileName);
+
+	stringstream ss;
+	ss << "[name:[" << absName << "]";
 	
-	long fsize = 0;
-	time_t mtime = 0;
+	CFileStat fileStat;
+	string digest;
 	
-	if (getFileInfo (absName, &fsize, &mtime)) {
-		
-		stringstream ss;
-		ss << ":exists:" << "size:" << fsize << ":time:" << mtime << ":";
-		
-		hash.update (ss.str());
-		
-	} else
-		hash.update (":not exists:");
+	// with sys.fingerprint = "content" a touched but unchanged file is no change, and a
+	// declared output always goes by its contents; directories and unreadable files still
+	// go by their stat
+	
+	if ((contentHash || fileCache.isOutput (absName)) && fileCache.getDigest (absName, digest))
+		ss << ":content:" << digest << ":";
+	else if (fileCache.getStat (absName, fileStat))
+		ss << ":exists:" << "size:" << fileStat.size << ":time:" << fileStat.mtimeNs / 1000000000 << ":";
+	else
+		ss << ":not exists:";
+	
+	ss << "]";
 	
-	hash.update ("]");
+	return ss.str ();
 	
 }
 
-void CDependsStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
+void CDependsStatement::computeFingerprints (vector<CDependsFingerprint>& fingerprints, size_t from) {
 
-	shared_ptr<CValue> value = expr -> evaluate (ctx);
+	// work items index the inputs of a block, then its outputs
+	
+	vector<pair<CDependsFingerprint *, size_t>> work;
+	
+	for (size_t i = from; i < fingerprints.size (); i++) {
+		for (size_t j = 0; j < fingerprints[i].files.size () + fingerprints[i].outputs.size (); j++)
+			work.push_back (pair<CDependsFingerprint *, size_t> (&fingerprints[i], j));
+	}
+	
+	auto computeOne = [] (CDependsFingerprint *fp, size_t index) {
+		if (index < fp -> files.size ())
+			fp -> fileHashes[index] = getFileFingerprint (fp -> baseDirectory, fp -> files[index], fp -> contentHash);
+		else {
+			index -= fp -> files.size ();
+			fp -> outputHashes[index] = getFileFingerprint (fp -> baseDirectory, fp -> outputs[index], fp -> contentHash);
+		}
+	};
+	
+	const size_t chunkSize = 256;
+	size_t chunks = (work.size () + chunkSize - 1) / chunkSize;
+	
+	if (chunks <= 1) {
+		CReleaseInterpreter unlocked;
+		for (size_t i = 0; i < work.size (); i++)
+			computeOne (work[i].first, work[i].second);
+		return;
+	}
+	
+	int threads = max ((int) thread::hardware_concurrency (), getJobCount ());
+	CWorkerPool pool (min (threads, (int) chunks));
+	
+	for (size_t chunk = 0; chunk < chunks; chunk++) {
+		pool.submit ([&work, &computeOne, chunk, chunkSize] () {
+			size_t end = min (work.size (), (chunk + 1) * chunkSize);
+			for (size_t i = chunk * chunkSize; i < end; i++)
+				computeOne (work[i].first, work[i].second);
+		});
+	}
+	
+	pool.wait ();
 
-	SHA1 hash;
-	hash.update ("depends:files[");
+}
+
+void CDependsStatement::collectInputs (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint) {
+
+	shared_ptr<CValue> value = expr -> evaluate (ctx);
+	
+	fingerprint.baseDirectory = getCurrentDirectory ();
+	fingerprint.files.clear ();
+	
+	shared_ptr<CValue> sysVar = ctx -> getVarStore () -> getVar ("sys");
+	fingerprint.contentHash = sysVar -> getType () == ValueDict && sysVar -> subscript ("fingerprint") -> asString () == "content";
 	
 	if (value -> getType () == ValueArray) {
 		for (int i = 0; i < value -> getLength (); i++) {
 			shared_ptr<CValue> elem = value -> subscript (i);
-			updateFileHash (hash, elem -> asString ());
+			fingerprint.files.push_back (elem -> asString ());
 		}
 	} else
-		updateFileHash (hash, value -> asString ());
+		fingerprint.files.push_back (value -> asString ());
+	
+	fingerprint.explicitCount = fingerprint.files.size ();
+	
+	if (depfileExpr) {
+		
+		fingerprint.depfileName = getAbsolutePath (makeSysSeparators (depfileExpr -> evaluate (ctx) -> asString ()));
+		fingerprint.depfileKey = ctx -> getCurModule () + "|" + ctx -> getCurTarget () + "|" + fingerprint.depfileName;
+		
+		// what the depfile named after the last run; nothing on the first, when the action runs anyway
+		
+		vector<string> discovered;
+		depfileStore.getInputs (fingerprint.depfileKey, discovered);
+		addDiscoveredInputs (fingerprint, discovered);
+		
+	}
+	
+	fingerprint.fileHashes.assign (fingerprint.files.size (), string ());
+	
+	fingerprint.outputs.clear ();
+	
+	if (producesExpr) {
+		
+		shared_ptr<CValue> outputs = producesExpr -> evaluate (ctx);
+		
+		if (outputs -> getType () == ValueArray) {
+			for (int i = 0; i < outputs -> getLength (); i++)
+				fingerprint.outputs.push_back (outputs -> subscript (i) -> asString ());
+		} else
+			fingerprint.outputs.push_back (outputs -> asString ());
+		
+		for (size_t i = 0; i < fingerprint.outputs.size (); i++)
+			fileCache.markOutput (getAbsoluteName (fingerprint.baseDirectory, fingerprint.outputs[i]));
+		
+	}
+	
+	fingerprint.outputHashes.assign (fingerprint.outputs.size (), string ());
+	
+}
+
+string CDependsStatement::finishFingerprint (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint) {
+
+	shared_ptr<CFingerprint> hash = CFingerprint::create ();
+	hash -> update ("depends:files[");
+	
+	for (size_t i = 0; i < fingerprint.explicitCount; i++)
+		hash -> update (fingerprint.fileHashes[i]);
+	
+	hash -> update ("]");
+	
+	if (!fingerprint.depfileKey.empty ()) {
+		hash -> update ("depfile:[");
+		for (size_t i = fingerprint.explicitCount; i < fingerprint.fileHashes.size (); i++)
+			hash -> update (fingerprint.fileHashes[i]);
+		hash -> update ("]");
+	}
+	
+	if (!fingerprint.outputs.empty ()) {
+		hash -> update ("produces:[");
+		for (size_t i = 0; i < fingerprint.outputHashes.size (); i++)
+			hash -> update (fingerprint.outputHashes[i]);
+		hash -> update ("]");
+	}
+	
+	actionStmt -> updateHash (ctx, *hash);
+	
+	return hash -> final ();
+	
+}
+
+void CDependsStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
+
+	vector<CDependsFingerprint> fingerprints (1, CDependsFingerprint (this));
+	
+	collectInputs (ctx, fingerprints[0]);
+	computeFingerprints (fingerprints, 0);
+	
+	runIfChanged (ctx, fingerprints[0]);
+	
+}
+
+/*
+	After the action of a block with a depfile, the inputs the depfile names replace the
+	ones from the last run. Declared outputs are fingerprinted again as the action left
+	them, by their contents: a missing or edited output no longer matches the stored hash,
+	and an output rewritten byte for byte does not change the fingerprint of the blocks
+	which use it, so they do not run again. The hash is then taken again; the listed inputs
+	keep their fingerprints from before the action. Outputs restored from the output cache
+	come with the inputs the depfile named when they were stored.
+*/
+
+string CDependsStatement::rehashAfterAction (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint, const vector<string> *restoredInputs) {
+
+	vector<string> discovered;
+	
+	if (!fingerprint.depfileKey.empty ()) {
+		
+		// without a depfile nothing is known of the inputs the action found, so no hash is
+		// stored and the block runs again next time
+		
+		if (restoredInputs != NULL)
+			discovered = *restoredInputs;
+		else if (!CDepfileStore::parse (fingerprint.depfileName, getCurrentDirectory (), discovered)) {
+			console.error ("lick: " + fingerprint.depfileName + " was not written by the action, the block will run again");
+			return string ();
+		}
+		
+		depfileStore.setInputs (fingerprint.depfileKey, discovered);
+		
+		fingerprint.files.resize (fingerprint.explicitCount);
+		fingerprint.fileHashes.resize (fingerprint.explicitCount);
+		addDiscoveredInputs (fingerprint, discovered);
+		
+	}
+	
+	{
+		CReleaseInterpreter unlocked;
+		
+		for (size_t i = fingerprint.fileHashes.size (); i < fingerprint.files.size (); i++)
+			fingerprint.fileHashes.push_back (getFileFingerprint (fingerprint.baseDirectory, fingerprint.files[i], fingerprint.contentHash));
+		
+		for (size_t i = 0; i < fingerprint.outputs.size (); i++) {
+			CFileStat fileStat;
+			if (!fileCache.getStat (getAbsoluteName (fingerprint.baseDirectory, fingerprint.outputs[i]), fileStat))
+				console.error ("lick: " + fingerprint.outputs[i] + " was not produced by the action");
+			fingerprint.outputHashes[i] = getFileFingerprint (fingerprint.baseDirectory, fingerprint.outputs[i], fingerprint.contentHash);
+		}
+	}
+	
+	return finishFingerprint (ctx, fingerprint);
+
+}
+
+/*
+	The output cache goes by what the listed inputs contain, whatever sys.fingerprint says,
+	so an entry is found again after a checkout has given every file a new mtime. A block
+	with an input which cannot be read, such as a directory, is not cached.
+*/
+
+bool CDependsStatement::getCacheKey (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint, string& key) {
+
+	shared_ptr<CValue> sysVar = ctx -> getVarStore () -> getVar ("sys");
+	if (sysVar -> getType () != ValueDict)
+		return false;
+	
+	string cacheDir = sysVar -> subscript ("output_cache") -> asString ();
+	if (cacheDir.empty ())
+		return false;
+	
+	outputCache.setDirectory (getAbsolutePath (makeSysSeparators (cacheDir)), (uint64_t) max (1, sysVar -> subscript ("output_cache_size") -> asInt ()));
+	
+	shared_ptr<CFingerprint> hash = CFingerprint::create ();
+	hash -> update ("output-cache:files[");
+	
+	{
+		CReleaseInterpreter unlocked;
+		
+		for (size_t i = 0; i < fingerprint.explicitCount; i++) {
+			string digest;
+			if (!fileCache.getDigest (getAbsoluteName (fingerprint.baseDirectory, fingerprint.files[i]), digest))
+				return false;
+			hash -> update ("[" + fingerprint.files[i] + ":" + digest + "]");
+		}
+	}
+	
+	hash -> update ("]produces:[");
+	for (size_t i = 0; i < fingerprint.outputs.size (); i++)
+		hash -> update ("[" + fingerprint.outputs[i] + "]");
+	hash -> update ("]");
+	
+	actionStmt -> updateHash (ctx, *hash);
+	
+	key = hash -> final ();
+	return true;
+
+}
+
+/*
+	The component list of a block is what went into its hash, one entry per input and
+	output and one for the action, stored whenever the action ran. On a miss it is held
+	against the current one to tell what changed; blocks in a loop are told apart by the
+	names of their listed inputs and outputs.
+*/
+
+string CDependsStatement::getComponentKey (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint) {
+
+	shared_ptr<CFingerprint> names = CFingerprint::create ();
+	
+	for (size_t i = 0; i < fingerprint.explicitCount; i++) {
+		names -> update (fingerprint.files[i]);
+		names -> update ("\n");
+	}
+	
+	for (size_t i = 0; i < fingerprint.outputs.size (); i++) {
+		names -> update (fingerprint.outputs[i]);
+		names -> update ("\n");
+	}
+	
+	return ctx -> getCurModule () + "|" + ctx -> getCurTarget () + "|" + getLocation () + "|" + names -> final ();
+
+}
+
+void CDependsStatement::getComponents (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint, CComponentList& components) {
+
+	for (size_t i = 0; i < fingerprint.files.size (); i++)
+		components.push_back (pair<string,string> ("input " + fingerprint.files[i], fingerprint.fileHashes[i]));
+	
+	for (size_t i = 0; i < fingerprint.outputs.size (); i++)
+		components.push_back (pair<string,string> ("output " + fingerprint.outputs[i], fingerprint.outputHashes[i]));
+	
+	shared_ptr<CFingerprint> action = CFingerprint::create ();
+	actionStmt -> updateHash (ctx, *action);
+	components.push_back (pair<string,string> ("action", action -> final ()));
+
+}
+
+string CDependsStatement::describe (CDependsFingerprint& fingerprint) {
+
+	stringstream ss;
+	ss << "[" << getLocation () << "]";
+	
+	// a block goes by its first output, or its first input
+	
+	const vector<string>& names = fingerprint.outputs.empty () ? fingerprint.files : fingerprint.outputs;
+	if (!names.empty ())
+		ss << " " << names[0] << (names.size () > 1 ? " ..." : "");
+	
+	return ss.str ();
+
+}
+
+void CDependsStatement::report (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint, bool upToDate, vector<string>& reasons) {
+
+	stringstream ss;
+	ss << (upToDate ? "up to date: " : dryRun ? "would run: " : "runs: ") << describe (fingerprint);
+	
+	if (!upToDate) {
+		
+		CComponentList previous, current;
+		getComponents (ctx, fingerprint, current);
+		
+		if (!componentStore.getComponents (getComponentKey (ctx, fingerprint), previous))
+			reasons.push_back ("no earlier run on record");
+		else
+			CComponentStore::explain (previous, current, reasons);
+		
+		if (reasons.empty ())
+			reasons.push_back ("nothing changed since the last run on record, but its hash is not stored");
+		
+		ss << " (";
+		for (size_t i = 0; i < reasons.size (); i++)
+			ss << (i > 0 ? ", " : "") << reasons[i];
+		ss << ")";
+		
+	}
+	
+	console.write (ss.str () + "\n");
+
+}
+
+bool CDependsStatement::runIfChanged (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint) {
+
+	string hashValue = finishFingerprint (ctx, fingerprint);
+	vector<string> reasons;
+	bool upToDate;
+	
+	if (dryRun) {
+		
+		// a dry run leaves the hash store as it is, and a block using what an out of date
+		// block would produce is taken to be out of date too
+		
+		upToDate = hashStore.peekHash (ctx -> getCurModule (), ctx -> getCurTarget (), hashValue);
+		
+		for (size_t i = 0; i < fingerprint.files.size (); i++) {
+			if (!pendingOutputs.empty () && pendingOutputs.find (getAbsoluteName (fingerprint.baseDirectory, fingerprint.files[i])) != pendingOutputs.end ()) {
+				reasons.push_back ("input " + fingerprint.files[i] + " would be produced again");
+				upToDate = false;
+			}
+		}
+		
+		report (ctx, fingerprint, upToDate, reasons);
+		
+		if (!upToDate) {
+			for (size_t i = 0; i < fingerprint.outputs.size (); i++)
+				pendingOutputs.insert (getAbsoluteName (fingerprint.baseDirectory, fingerprint.outputs[i]));
+		}
+		
+		return false;
+		
+	}
+	
+	upToDate = hashStore.containsHash (ctx -> getCurModule (), ctx -> getCurTarget (), hashValue);
+	
+	if (upToDate)
+		return false;
+	
+	if (explain)
+		report (ctx, fingerprint, false, reasons);
 	
-	hash.update ("]");
+	// with sys.output_cache set, the declared outputs may come from an earlier build of the
+	// same inputs instead of from the action
 	
-	actionStmt -> updateHash (ctx, hash);
+	string cacheKey;
+	vector<string> outputNames, restoredInputs;
+	bool cacheable = !fingerprint.outputs.empty () && getCacheKey (ctx, fingerprint, cacheKey);
+	bool restored = false;
 	
-	string hashValue = hash.final ();
+	if (cacheable) {
+		
+		for (size_t i = 0; i < fingerprint.outputs.size (); i++)
+			outputNames.push_back (getAbsoluteName (fingerprint.baseDirectory, fingerprint.outputs[i]));
+		
+		CReleaseInterpreter unlocked;
+		restored = outputCache.restore (cacheKey, outputNames, restoredInputs);
+		
+	}
 	
-	if (!hashStore.containsHash (ctx -> getCurModule (), ctx -> getCurTarget (), hashValue)) {
+	if (restored)
+		console.write ("from cache: " + describe (fingerprint) + "\n");
+	else {
+		
+		if (cacheable) {
+			CReleaseInterpreter unlocked;
+			outputCache.detach (outputNames);
+		}
+		
+		int firstJob = jobTable.getNextId ();
+		
 		actionStmt -> execute (ctx);
-		hashStore.addHash (ctx -> getCurModule (), ctx -> getCurTarget (), hashValue);
+		
+		// the depfile and the outputs are there only once the jobs the action spawned are
+		// done; if one of them failed, nothing is recorded and the target fails when it
+		// collects them
+		
+		if (!fingerprint.depfileKey.empty () || !fingerprint.outputs.empty ()) {
+			
+			bool succeeded = jobTable.waitFinished (firstJob);
+			fileCache.invalidateAll ();
+			
+			if (!succeeded)
+				return true;
+			
+		}
+		
+	}
+	
+	if (!fingerprint.depfileKey.empty () || !fingerprint.outputs.empty ()) {
+		hashValue = rehashAfterAction (ctx, fingerprint, restored ? &restoredInputs : NULL);
+		if (hashValue.empty ())
+			return true;
 	}
 	
+	// a job still running, spawned before the block, might yet write the outputs
+	
+	if (cacheable && !restored && jobTable.hasRunning ())
+		console.error ("lick: jobs are still running, " + describe (fingerprint) + " is not stored in the output cache");
+	else if (cacheable && !restored) {
+		vector<string> discovered (fingerprint.files.begin () + fingerprint.explicitCount, fingerprint.files.end ());
+		CReleaseInterpreter unlocked;
+		outputCache.store (cacheKey, outputNames, discovered);
+	}
+	
+	hashStore.addHash (ctx -> getCurModule (), ctx -> getCurTarget (), hashValue);
+	
+	CComponentList components;
+	getComponents (ctx, fingerprint, components);
+	componentStore.setComponents (getComponentKey (ctx, fingerprint), components);
+	
+	return true;
+
 }
 
-void CDependsStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) { 
+/*
+	Fingerprints of consecutive depends blocks are computed up front, concurrently; so are
+	those of every iteration of a for loop whose body is nothing but depends blocks, with
+	loopVarName set to the item of each. Once an action runs it may have produced inputs of
+	the blocks below it, so the fingerprints of the remaining blocks are computed again; on
+	a no-op build that never happens. In a loop, continue skips the rest of the iteration
+	and break the rest of the loop, as they would without the batch.
+*/
+
+void CDependsStatement::executeBatch (shared_ptr<CExecutionContext> ctx, vector<CDependsFingerprint>& fingerprints, const string& loopVarName) {
+
+	size_t next = 0;
+	
+	while (next < fingerprints.size ()) {
+		
+		for (size_t i = next; i < fingerprints.size (); i++) {
+			CDependsFingerprint& fp = fingerprints[i];
+			if (!loopVarName.empty ())
+				ctx -> getVarStore () -> setVar (loopVarName, fp.item);
+			fp.stmt -> withLocation ([&] () { fp.stmt -> collectInputs (ctx, fp); });
+		}
+		
+		computeFingerprints (fingerprints, next);
+		
+		while (next < fingerprints.size ()) {
+			
+			CDependsFingerprint& fp = fingerprints[next];
+			CDependsStatement *stmt = fp.stmt;
+			bool executed = false;
+			
+			next ++;
+			
+			if (!loopVarName.empty ())
+				ctx -> getVarStore () -> setVar (loopVarName, fp.item);
+			
+			stmt -> withLocation ([&] () { executed = stmt -> runIfChanged (ctx, fp); });
+			
+			if (!loopVarName.empty () && ctx -> breakSignaled) {
+				ctx -> breakSignaled = false;
+				return;
+			}
+			
+			if (!loopVarName.empty () && ctx -> continueSignaled) {
+				ctx -> continueSignaled = false;
+				while (next < fingerprints.size () && fingerprints[next].iteration == fp.iteration)
+					next ++;
+			}
+			
+			if (ctx -> breakSignaled || ctx -> continueSignaled || ctx -> returnSignaled)
+				return;
+			
+			if (executed)
+				break;
+			
+		}
+		
+	}
+	
+}
+
+void CDependsStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) { 
 	hash.update ("expr:"); expr -> updateHash (ctx, hash);
+	if (depfileExpr) {
+		hash.update ("depfile:"); depfileExpr -> updateHash (ctx, hash);
+	}
+	if (producesExpr) {
+		hash.update ("produces:"); producesExpr -> updateHash (ctx, hash);
+	}
 	hash.update ("stmt:"); actionStmt -> updateHash (ctx, hash);
 }
 
@@ -237,7 +901,7 @@ void CIfStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 	}
 }
 
-void CIfStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+void CIfStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	hash.update ("expr:"); expr -> updateHash (ctx, hash);
 	hash.update ("then:"); thenStmt -> updateHash (ctx, hash);
 	if (elseStmt)
@@ -245,13 +909,14 @@ void CIfStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash
 }
 
 
-CForStatement::CForStatement (const string& keyword, CInputParser& parser): CStatement (parser)  {
+CForStatement::CForStatement (const string& keyword, CInputParser& parser, bool p_isParallel): CStatement (parser)  {
 
 	CToken token = parser.getToken ();
 	if (token.getValue () != "(")
 		throw ESyntaxError (parser, "( expected");
 
 	isForeach = false;
+	isParallel = p_isParallel;
 
 	if (keyword == "for") {
 		
@@ -277,6 +942,9 @@ CForStatement::CForStatement (const string& keyword, CInputParser& parser): CSta
 			
 		} else {
 			
+			if (isParallel)
+				throw ESyntaxError (parser, "parallel for expects (name in expression)");
+			
 			initExpr = CExpression::parse (parser, 0);
 			
 			token = parser.getToken ();
@@ -311,11 +979,68 @@ CForStatement::CForStatement (const string& keyword, CInputParser& parser): CSta
 
 void CForStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 	
-	if (isForeach) {
+	if (isForeach && isParallel) {
 		
 		shared_ptr<CValue> arr = initExpr -> evaluate (ctx);
+		vector<shared_ptr<CValue>> items;
 		
 		if (arr -> getType () == ValueDict) {
+			list<string> keys;
+			arr -> getKeys (keys);
+			for (list<string>::iterator it = keys.begin (); it != keys.end (); it++)
+				items.push_back (shared_ptr<CValue> (new CStringValue (*it)));
+		} else if (arr -> getType () == ValueArray) {
+			for (int index = 0; index < arr -> getLength(); index ++)
+				items.push_back (arr -> subscript (index));
+		} else
+			items.push_back (arr);
+		
+		executeParallel (ctx, items);
+		
+	} else if (isForeach) {
+		
+		shared_ptr<CValue> arr = initExpr -> evaluate (ctx);
+		
+		// a body of depends blocks only is fingerprinted for all iterations at once, over the
+		// elements of an array or the keys of a dict alike
+		
+		vector<CDependsStatement *> blocks;
+		CCompoundStatement *body = dynamic_cast<CCompoundStatement *> (loopStmt.get ());
+		CDependsStatement *single = dynamic_cast<CDependsStatement *> (loopStmt.get ());
+		
+		if (single != NULL)
+			blocks.push_back (single);
+		else if (body == NULL || !body -> getDependsBlocks (blocks))
+			blocks.clear ();
+		
+		vector<shared_ptr<CValue>> items;
+		
+		if (!blocks.empty () && arr -> getType () == ValueDict) {
+			list<string> keys;
+			arr -> getKeys (keys);
+			for (list<string>::iterator it = keys.begin (); it != keys.end (); it++)
+				items.push_back (shared_ptr<CValue> (new CStringValue (*it)));
+		} else if (!blocks.empty () && arr -> getType () == ValueArray) {
+			for (int index = 0; index < arr -> getLength (); index ++)
+				items.push_back (arr -> subscript (index));
+		}
+		
+		if (!items.empty ()) {
+			
+			vector<CDependsFingerprint> fingerprints;
+			
+			for (size_t index = 0; index < items.size (); index ++) {
+				for (size_t i = 0; i < blocks.size (); i++) {
+					CDependsFingerprint fp (blocks[i]);
+					fp.iteration = index;
+					fp.item = items[index];
+					fingerprints.push_back (fp);
+				}
+			}
+			
+			CDependsStatement::executeBatch (ctx, fingerprints, foreachVarName);
+			
+		} else if (arr -> getType () == ValueDict) {
 			
 			list<string> keys;
 			arr -> getKeys (keys);
@@ -399,7 +1124,186 @@ void CForStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 	
 }
 
-void CForStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) {
+/*
+	Every iteration of a parallel for runs in its own isolated scope layered over the enclosing
+	one, so plain assignments stay private to the iteration, and so do assignments into arrays
+	and dicts, which are copied into the scope first. Once all iterations are done, variables
+	which already existed outside the loop are merged back in iteration order, relative to their
+	value before the loop: ints add up their deltas, arrays and strings append what each
+	iteration appended, arrays and dicts take every element an iteration set, and anything else
+	is taken from the last iteration that assigned it. Names first assigned inside the body are
+	discarded.
+*/
+
+void CForStatement::executeParallel (shared_ptr<CExecutionContext> ctx, const vector<shared_ptr<CValue>>& items) {
+
+	if (items.empty ())
+		return;
+	
+	vector<shared_ptr<CExecutionContext>> scopes (items.size ());
+	bool stopped = false;
+	
+	// iterations that took longest last time start first; new ones keep their order
+	
+	shared_ptr<CFingerprint> loopHash = CFingerprint::create ();
+	loopStmt -> updateHash (ctx, *loopHash);
+	string loopKey = loopHash -> final ();
+	
+	vector<string> keys (items.size ());
+	vector<double> estimates (items.size (), 0);
+	vector<size_t> order (items.size ());
+	
+	for (size_t i = 0; i < items.size (); i++) {
+		shared_ptr<CFingerprint> itemHash = CFingerprint::create ();
+		itemHash -> update (loopKey);
+		itemHash -> update (items[i] -> asString ());
+		keys[i] = "for:" + itemHash -> final ();
+		durationHistory.getDuration (keys[i], estimates[i]);
+		order[i] = i;
+	}
+	
+	stable_sort (order.begin (), order.end (), [&] (size_t a, size_t b) { return estimates[a] > estimates[b]; });
+	
+	{
+		CWorkerPool pool (min (getJobCount (), (int) items.size ()));
+		size_t nextItem = 0;
+		
+		for (size_t n = 0; n < items.size (); n++) {
+			
+			pool.submit ([&] () {
+				
+				CHoldInterpreter interpreter;
+				
+				if (stopped || pool.failed ())
+					return;
+				
+				size_t i = order[nextItem ++];
+				
+				shared_ptr<CExecutionContext> scope = ctx -> enterScope (true);
+				scope -> getVarStore () -> setVar (foreachVarName, items[i]);
+				
+				{
+					CDurationTimer timer (keys[i]);
+					
+					loopStmt -> execute (scope);
+					
+					bool succeeded = jobTable.waitAll (true);
+					fileCache.invalidateAll ();
+					if (!succeeded)
+						throw runtime_error ("Command exec failed");
+				}
+				
+				if (scope -> returnSignaled)
+					throw runtime_error ("return is not allowed inside parallel for");
+				
+				if (scope -> breakSignaled)
+					stopped = true;
+				
+				scopes[i] = scope;
+				
+			});
+			
+		}
+		
+		pool.wait ();
+	}
+	
+	shared_ptr<CVarStore> outer = ctx -> getVarStore ();
+	map<string, shared_ptr<CValue>> merged;
+	
+	for (size_t i = 0; i < scopes.size (); i++) {
+		
+		if (!scopes[i])
+			continue;
+		
+		map<string, shared_ptr<CValue>> written;
+		scopes[i] -> getVarStore () -> getLocalVars (written);
+		
+		for (map<string, shared_ptr<CValue>>::iterator it = written.begin (); it != written.end (); it++) {
+			
+			if (it -> first == foreachVarName || !outer -> hasVar (it -> first))
+				continue;
+			
+			shared_ptr<CValue> original = outer -> getVar (it -> first);
+			
+			map<string, shared_ptr<CValue>>::iterator prev = merged.find (it -> first);
+			shared_ptr<CValue> current = (prev != merged.end ()) ? prev -> second : original;
+			
+			merged[it -> first] = mergeValue (original, current, it -> second);
+			
+		}
+		
+	}
+	
+	for (map<string, shared_ptr<CValue>>::iterator it = merged.begin (); it != merged.end (); it++)
+		outer -> setVar (it -> first, it -> second);
+	
+}
+
+shared_ptr<CValue> CForStatement::mergeValue (shared_ptr<CValue> original, shared_ptr<CValue> merged, shared_ptr<CValue> written) {
+
+	if (original -> getType () != written -> getType ())
+		return written;
+	
+	switch (original -> getType ()) {
+		
+		case ValueInt:
+			return shared_ptr<CValue> (new CIntValue (merged -> asInt () + written -> asInt () - original -> asInt ()));
+		
+		case ValueString:
+		{
+			string before = original -> asString ();
+			string after = written -> asString ();
+			if (after.compare (0, before.length (), before) != 0)
+				return written;
+			return shared_ptr<CValue> (new CStringValue (merged -> asString () + after.substr (before.length ())));
+		}
+		
+		case ValueArray:
+		{
+			if (written -> getLength () < original -> getLength ())
+				return written;
+			
+			// an element the iteration did not set is still the value it was copied with
+			
+			CArrayValue *result = new CArrayValue ();
+			for (int i = 0; i < merged -> getLength (); i++) {
+				bool assigned = i < original -> getLength () && written -> subscript (i) != original -> subscript (i);
+				result -> append (shared_ptr<CValueRef> (new CValueRef (assigned ? written -> subscript (i) : merged -> subscript (i))));
+			}
+			for (int i = original -> getLength (); i < written -> getLength (); i++)
+				result -> append (shared_ptr<CValueRef> (new CValueRef (written -> subscript (i))));
+			
+			return shared_ptr<CValue> (result);
+		}
+		
+		case ValueDict:
+		{
+			CDictValue *result = new CDictValue ();
+			list<string> keys;
+			
+			merged -> getKeys (keys);
+			for (list<string>::iterator it = keys.begin (); it != keys.end (); it++)
+				result -> subscriptRef (*it) -> setValue (merged -> subscript (*it));
+			
+			keys.clear ();
+			written -> getKeys (keys);
+			for (list<string>::iterator it = keys.begin (); it != keys.end (); it++) {
+				if (written -> subscript (*it) != original -> subscript (*it))
+					result -> subscriptRef (*it) -> setValue (written -> subscript (*it));
+			}
+			
+			return shared_ptr<CValue> (result);
+		}
+		
+		default:
+			return written;
+		
+	}
+	
+}
+
+void CForStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) {
 	if (initExpr)
 		hash.update ("init:"); initExpr -> updateHash (ctx, hash);
 	if (whileExpr)
@@ -412,6 +1316,9 @@ void CForStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& has
 		hash.update ("foreach:");
 		hash.update (foreachVarName);
 	}
+	
+	if (isParallel)
+		hash.update ("parallel:");
 }
 
 
@@ -463,7 +1370,7 @@ void CReturnStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 	
 }
 
-void CReturnStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) { 
+void CReturnStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) { 
 	if (expr)
 		expr -> updateHash (ctx, hash);
 }
@@ -523,7 +1430,7 @@ void CIncludeStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 	}
 }
 
-void CIncludeStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) { 
+void CIncludeStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) { 
 	expr -> updateHash (ctx, hash);
 }
 
@@ -544,6 +1451,10 @@ void CUsingStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 	if (!ctx -> getBaseContext () -> hasIncludedModule (usingPath)) {
 		
 		hashStore.setNameFromModule (usingPath);
+		durationHistory.setNameFromModule (usingPath);
+		fileCache.setNameFromModule (usingPath);
+		depfileStore.setNameFromModule (usingPath);
+		componentStore.setNameFromModule (usingPath);
 		
 		size_t pos = usingPath.find_last_of (getAnyPathSeparator ());
 		string dirName = usingPath.substr (0, pos);
@@ -566,6 +1477,6 @@ void CUsingStatement::executeThrow (shared_ptr<CExecutionContext> ctx) {
 	}
 }
 
-void CUsingStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) { 
+void CUsingStatement::updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) { 
 	expr -> updateHash (ctx, hash);
 }
@@ -2,13 +2,17 @@
 #define __STMT_H__
 
 #include <memory>
+#include <vector>
+#include <functional>
 
 class CStatement;
+class CDependsStatement;
 
 #include "parser.h"
 #include "expr.h"
 #include "context.h"
-#include "sha1.h"
+#include "fingerprint.h"
+#include "explain.h"
 
 using namespace std;
 
@@ -43,16 +47,19 @@ class CStatement {
 	
 	protected:
 	
-		virtual void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) = 0;
+		virtual void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) = 0;
 		virtual void executeThrow (shared_ptr<CExecutionContext> ctx) = 0;
 		
+		void withLocation (function<void()> action);
+		string getLocation ();
+		
 	public:
 		
 		CStatement (CInputParser& parser);
 		
 		static shared_ptr<CStatement> parse (CInputParser& parser);
 
-		void updateHash (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHash (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		void execute (shared_ptr<CExecutionContext> ctx);
 	
 };
@@ -65,7 +72,7 @@ class CExprStatement: public CStatement {
 
 	protected:
 		
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 		
 	public:
@@ -83,12 +90,16 @@ class CCompoundStatement: public CStatement {
 		
 	protected:
 		
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 		
 	public:
 		
 		CCompoundStatement (CInputParser& parser);
+		
+		// whether every statement is a depends block, and which they are
+		
+		bool getDependsBlocks (vector<CDependsStatement *>& blocks);
 	
 };
 
@@ -102,7 +113,7 @@ class CIfStatement: public CStatement {
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 		
 	public:
@@ -121,16 +132,20 @@ class CForStatement: public CStatement {
 		shared_ptr<CStatement> loopStmt;
 		
 		bool isForeach;
+		bool isParallel;
 		string foreachVarName;
+		
+		void executeParallel (shared_ptr<CExecutionContext> ctx, const vector<shared_ptr<CValue>>& items);
+		shared_ptr<CValue> mergeValue (shared_ptr<CValue> original, shared_ptr<CValue> merged, shared_ptr<CValue> written);
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 		
 	public:
 		
-		CForStatement (const string& keyword, CInputParser& parser);
+		CForStatement (const string& keyword, CInputParser& parser, bool p_isParallel = false);
 	
 };
 
@@ -138,7 +153,7 @@ class CBreakStatement: public CStatement {
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) { }
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) { }
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 	
 	public:
@@ -152,7 +167,7 @@ class CContinueStatement: public CStatement {
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash) { }
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash) { }
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 		
 	public:
@@ -169,7 +184,7 @@ class CReturnStatement: public CStatement {
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 		
 	public:
@@ -186,7 +201,7 @@ class CIncludeStatement: public CStatement {
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 		
 	public:
@@ -203,7 +218,7 @@ class CUsingStatement: public CStatement {
 
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 		
 	public:
@@ -212,24 +227,80 @@ class CUsingStatement: public CStatement {
 	
 };
 
+/*
+	Fingerprint of one depends block: the listed files, and for each of them the hash input
+	built from its absolute name, size and mtime. With a depfile, the inputs it named last
+	time follow the listed ones, from explicitCount on. Declared outputs and their hash
+	inputs are kept apart. In a batch made of the iterations of a for loop, item is the
+	value of the loop variable the block runs with.
+*/
+
+class CDependsFingerprint {
+	
+	public:
+	
+		CDependsStatement *stmt;
+		string baseDirectory;
+		vector<string> files;
+		vector<string> fileHashes;
+		bool contentHash;
+		
+		size_t explicitCount;
+		string depfileName;
+		string depfileKey;
+		
+		vector<string> outputs;
+		vector<string> outputHashes;
+		
+		size_t iteration;
+		shared_ptr<CValue> item;
+		
+		CDependsFingerprint (CDependsStatement *p_stmt): stmt (p_stmt), contentHash (false), explicitCount (0), iteration (0) { }
+	
+};
+
 class CDependsStatement: public CStatement {
 
 	private:
 		
 		shared_ptr<CExpression> expr;
+		shared_ptr<CExpression> depfileExpr;
+		shared_ptr<CExpression> producesExpr;
 		shared_ptr<CStatement> actionStmt;
 		
-		void updateFileHash (SHA1& hash, const string& fileName);
+		static string getAbsoluteName (const string& baseDirectory, const string& fileName);
+		static string getFileFingerprint (const string& baseDirectory, const string& fileName, bool contentHash);
+		static void computeFingerprints (vector<CDependsFingerprint>& fingerprints, size_t from);
+		static void addDiscoveredInputs (CDependsFingerprint& fingerprint, const vector<string>& discovered);
+		
+		void collectInputs (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint);
+		string finishFingerprint (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint);
+		string rehashAfterAction (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint, const vector<string> *restoredInputs);
+		bool getCacheKey (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint, string& key);
+		string describe (CDependsFingerprint& fingerprint);
+		string getComponentKey (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint);
+		void getComponents (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint, CComponentList& components);
+		void report (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint, bool upToDate, vector<string>& reasons);
+		bool runIfChanged (shared_ptr<CExecutionContext> ctx, CDependsFingerprint& fingerprint);
 		
 	protected:
 	
-		void updateHashArgs (shared_ptr<CExecutionContext> ctx, SHA1& hash);
+		void updateHashArgs (shared_ptr<CExecutionContext> ctx, CFingerprint& hash);
 		void executeThrow (shared_ptr<CExecutionContext> ctx);
 		
 	public:
 		
 		CDependsStatement (CInputParser& parser);
+		
+		static void executeBatch (shared_ptr<CExecutionContext> ctx, vector<CDependsFingerprint>& fingerprints, const string& loopVarName = "");
 	
 };
 
+// lick --dry-run: depends blocks only report whether they would run; --explain: they say why they run
+
+void setDryRun (bool dryRun);
+bool getDryRun ();
+void setExplain (bool explain);
+bool getExplain ();
+
 #endif /* __STMT_H__ */
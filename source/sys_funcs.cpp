@@ -1,26 +1,355 @@
 #define _BSD_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdexcept>
 #include <iostream>
+#include <sstream>
 #include <cstring>
+#include <cerrno>
 
 #ifdef _MSC_VER
 # include <windows.h>
 # include <direct.h>
 # include <lmcons.h>
+# include <io.h>
+# include <sys/utime.h>
+# include <fcntl.h>
 #else
 # include <dirent.h>
 # include <sys/wait.h>
+# include <signal.h>
 # include <unistd.h>
 # include <sys/select.h>
 # include <sys/sendfile.h>
 # include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/ioctl.h>
+# include <utime.h>
+# ifdef __linux__
+#  include <linux/fs.h>
+# endif
 #endif
 
 #include "sys_funcs.h"
+#include "threads.h"
+#include "console.h"
+#include "history.h"
+
+bool CMappedFile::open (const string& fileName) {
+
+	close ();
+	
+#ifdef _MSC_VER
+
+	HANDLE hFile = CreateFile (fileName.c_str (), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx (hFile, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle (hFile);
+		return false;
+	}
+	
+	HANDLE hMapping = CreateFileMapping (hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL) {
+		CloseHandle (hFile);
+		return false;
+	}
+	
+	void *view = MapViewOfFile (hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		CloseHandle (hMapping);
+		CloseHandle (hFile);
+		return false;
+	}
+	
+	fileHandle = (intptr_t) hFile;
+	mappingHandle = (intptr_t) hMapping;
+	data = (const char *) view;
+	size = (size_t) fileSize.QuadPart;
+	
+#else
+
+	int fd = ::open (fileName.c_str (), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+	
+	struct stat st;
+	if (fstat (fd, &st) != 0 || st.st_size == 0) {
+		::close (fd);
+		return false;
+	}
+	
+	void *view = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	
+	// the mapping keeps the file alive, even if it is replaced or deleted
+	
+	::close (fd);
+	
+	if (view == MAP_FAILED)
+		return false;
+	
+	data = (const char *) view;
+	size = st.st_size;
+
+#endif
+
+	return true;
+
+}
+
+void CMappedFile::close () {
+
+	if (data == NULL)
+		return;
+	
+#ifdef _MSC_VER
+	UnmapViewOfFile ((void *) data);
+	CloseHandle ((HANDLE) mappingHandle);
+	CloseHandle ((HANDLE) fileHandle);
+#else
+	munmap ((void *) data, size);
+#endif
+
+	data = NULL;
+	size = 0;
+	fileHandle = -1;
+	mappingHandle = -1;
+
+}
+
+bool CFileLock::open (const string& fileName) {
+
+	close ();
+
+#ifdef _MSC_VER
+
+	HANDLE hFile = CreateFile (fileName.c_str (), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	
+	fileHandle = (intptr_t) hFile;
+
+#else
+
+	// fcntl locks vanish when any descriptor of the file is closed, so this must be the only one
+	
+	int fd = ::open (fileName.c_str (), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (fd == -1)
+		return false;
+	
+	fileHandle = fd;
+
+#endif
+
+	return true;
+
+}
+
+void CFileLock::close () {
+
+	if (fileHandle == -1)
+		return;
+	
+	unlock ();
+	
+#ifdef _MSC_VER
+	CloseHandle ((HANDLE) fileHandle);
+#else
+	::close (fileHandle);
+#endif
+
+	fileHandle = -1;
+
+}
+
+bool CFileLock::lock (bool exclusive, bool wait) {
+
+	if (fileHandle == -1)
+		return false;
+	
+#ifdef _MSC_VER
+
+	unlock ();
+	
+	OVERLAPPED overlapped;
+	memset (&overlapped, 0, sizeof (overlapped));
+	
+	DWORD flags = (exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0) | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+	if (!LockFileEx ((HANDLE) fileHandle, flags, 0, 1, 0, &overlapped))
+		return false;
+
+#else
+
+	struct flock fl;
+	memset (&fl, 0, sizeof (fl));
+	fl.l_type = exclusive ? F_WRLCK : F_RDLCK;
+	fl.l_whence = SEEK_SET;
+	
+	int rc;
+	do {
+		rc = fcntl (fileHandle, wait ? F_SETLKW : F_SETLK, &fl);
+	} while (rc == -1 && errno == EINTR);
+	
+	if (rc == -1)
+		return false;
+
+#endif
+
+	locked = true;
+	return true;
+
+}
+
+void CFileLock::unlock () {
+
+	if (!locked)
+		return;
+	
+#ifdef _MSC_VER
+
+	OVERLAPPED overlapped;
+	memset (&overlapped, 0, sizeof (overlapped));
+	UnlockFileEx ((HANDLE) fileHandle, 0, 1, 0, &overlapped);
+
+#else
+
+	struct flock fl;
+	memset (&fl, 0, sizeof (fl));
+	fl.l_type = F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fcntl (fileHandle, F_SETLK, &fl);
+
+#endif
+
+	locked = false;
+
+}
+
+bool replaceFile (const string& from, const string& to) {
+
+#ifdef _MSC_VER
+	return MoveFileEx (from.c_str (), to.c_str (), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename (from.c_str (), to.c_str ()) == 0;
+#endif
+
+}
+
+/*
+	Writes a temp file next to fileName, syncs it and renames it over fileName, so readers
+	(and a later run after a crash) see either the old or the new contents, never a mix.
+*/
+
+bool writeFileAtomically (const string& fileName, const string& contents) {
+
+	stringstream ss;
+#ifdef _MSC_VER
+	ss << fileName << ".tmp." << GetCurrentProcessId ();
+#else
+	ss << fileName << ".tmp." << getpid ();
+#endif
+	string tempName = ss.str ();
+	
+#ifdef _MSC_VER
+
+	HANDLE hFile = CreateFile (tempName.c_str (), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	
+	DWORD written = 0;
+	bool ok = contents.empty () || (WriteFile (hFile, contents.data (), (DWORD) contents.length (), &written, NULL) && written == contents.length ());
+	ok = ok && FlushFileBuffers (hFile);
+	CloseHandle (hFile);
+
+#else
+
+	int fd = open (tempName.c_str (), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd == -1)
+		return false;
+	
+	bool ok = true;
+	size_t pos = 0;
+	
+	while (ok && pos < contents.length ()) {
+		ssize_t rc = write (fd, contents.data () + pos, contents.length () - pos);
+		if (rc > 0)
+			pos += rc;
+		else if (rc < 0 && errno != EINTR)
+			ok = false;
+	}
+	
+	ok = ok && fsync (fd) == 0;
+	ok = (close (fd) == 0) && ok;
+
+#endif
+
+	if (!ok || !replaceFile (tempName, fileName)) {
+		remove (tempName.c_str ());
+		return false;
+	}
+	
+	return true;
+
+}
+
+bool syncFile (FILE *file) {
+
+	if (fflush (file) != 0)
+		return false;
+
+#ifdef _MSC_VER
+	return _commit (_fileno (file)) == 0;
+#else
+	return fsync (fileno (file)) == 0;
+#endif
+
+}
+
+/*
+	Opens a file for appending such that every write lands at the end, even with other
+	processes appending to it at the same time.
+*/
+
+FILE *openAppendFile (const string& fileName) {
+
+#ifdef _MSC_VER
+
+	// without FILE_WRITE_DATA the system appends each write atomically
+
+	HANDLE hFile = CreateFile (fileName.c_str (), FILE_APPEND_DATA | SYNCHRONIZE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return NULL;
+	
+	int fd = _open_osfhandle ((intptr_t) hFile, _O_APPEND | _O_BINARY);
+	if (fd == -1) {
+		CloseHandle (hFile);
+		return NULL;
+	}
+	
+	FILE *file = _fdopen (fd, "ab");
+	if (file == NULL)
+		_close (fd);
+
+#else
+
+	int fd = open (fileName.c_str (), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (fd == -1)
+		return NULL;
+	
+	FILE *file = fdopen (fd, "ab");
+	if (file == NULL)
+		close (fd);
+
+#endif
+
+	return file;
+
+}
 
 string getPathSeparator () {
 #ifdef _MSC_VER
@@ -204,6 +533,105 @@ void copyOneFile (const string& path, const string& to) {
 }
 
 
+/*
+	Makes "to" a copy of the regular file "from" as cheaply as the file system allows: a
+	reflink (FICLONE on btrfs, XFS and the like) shares the blocks but stays a file of its
+	own; failing that, a hard link when allowHardLink is set, which shares the file itself;
+	failing that, a plain copy. "to" must not exist.
+*/
+
+bool cloneFile (const string& from, const string& to, bool allowHardLink) {
+
+#ifdef _MSC_VER
+
+	if (allowHardLink && CreateHardLink (to.c_str (), from.c_str (), NULL))
+		return true;
+	
+	return CopyFile (from.c_str (), to.c_str (), TRUE) != 0;
+
+#else
+
+#ifdef FICLONE
+	
+	int input = open (from.c_str (), O_RDONLY | O_CLOEXEC);
+	if (input == -1)
+		return false;
+	
+	struct stat fileinfo;
+	if (fstat (input, &fileinfo) != 0) {
+		close (input);
+		return false;
+	}
+	
+	int output = open (to.c_str (), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, fileinfo.st_mode & 0777);
+	if (output == -1) {
+		close (input);
+		return false;
+	}
+	
+	bool cloned = ioctl (output, FICLONE, input) == 0;
+	close (input);
+	close (output);
+	
+	if (cloned)
+		return true;
+	
+	unlink (to.c_str ());
+	
+#endif
+	
+	if (allowHardLink && link (from.c_str (), to.c_str ()) == 0)
+		return true;
+	
+	try {
+		copyOneFile (from, to);
+	} catch (exception& e) {
+		unlink (to.c_str ());
+		return false;
+	}
+	
+	return true;
+
+#endif
+
+}
+
+int getLinkCount (const string& path) {
+
+#ifdef _MSC_VER
+
+	HANDLE hFile = CreateFile (path.c_str (), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return 0;
+	
+	BY_HANDLE_FILE_INFORMATION info;
+	BOOL ok = GetFileInformationByHandle (hFile, &info);
+	CloseHandle (hFile);
+	
+	return ok ? (int) info.nNumberOfLinks : 0;
+
+#else
+
+	struct stat s;
+	if (lstat (path.c_str (), &s) != 0)
+		return 0;
+	
+	return (int) s.st_nlink;
+
+#endif
+
+}
+
+void touchFile (const string& path) {
+
+#ifdef _MSC_VER
+	_utime (path.c_str (), NULL);
+#else
+	utime (path.c_str (), NULL);
+#endif
+
+}
+
 void copyFile (const string& path, const string& to) {
 	
 	if (isDirectory (path)) {
@@ -349,7 +777,15 @@ void deleteFileOrDir (const string& path) {
 }
 
 
-int runCommand (const list<string>& params, string *capture_stdout, map<string,string>* env) {
+/*
+	stdinHandle / stdoutHandle, when not -1, replace the child's stdin / stdout (fd on unix,
+	HANDLE on windows). They are the only handles the child inherits from the caller, so
+	they should be created non-inheritable (O_CLOEXEC).
+*/
+
+bool startCommand (const list<string>& params, bool captureStdout, map<string,string>* env, CChildProcess& process, intptr_t stdinHandle, intptr_t stdoutHandle) {
+
+	CDurationTimer::noteWork ();
 
 #ifdef _MSC_VER
 
@@ -394,7 +830,7 @@ int runCommand (const list<string>& params, string *capture_stdout, map<string,s
 	
 	HANDLE hStdoutRead, hStdoutWrite;
 	
-	if (capture_stdout) {
+	if (captureStdout) {
 	
 		SECURITY_ATTRIBUTES sa;
 		
@@ -414,61 +850,89 @@ int runCommand (const list<string>& params, string *capture_stdout, map<string,s
 	memset (&startupInfo, 0, sizeof (STARTUPINFO));
 	startupInfo.cb = sizeof (STARTUPINFO);
 	startupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE); 
-	startupInfo.hStdOutput = capture_stdout ? hStdoutWrite : GetStdHandle (STD_OUTPUT_HANDLE); 
+	startupInfo.hStdOutput = captureStdout ? hStdoutWrite : GetStdHandle (STD_OUTPUT_HANDLE); 
 	startupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE); 
 	startupInfo.dwFlags |= STARTF_USESTDHANDLES;	
 	
-	memset (&procInfo, 0, sizeof (PROCESS_INFORMATION));
+	if (stdinHandle != -1) {
+		startupInfo.hStdInput = (HANDLE) stdinHandle;
+		SetHandleInformation ((HANDLE) stdinHandle, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+	}
 	
-	cout << "run: \"" << cmdline << "\"" << endl;
+	if (stdoutHandle != -1) {
+		startupInfo.hStdOutput = (HANDLE) stdoutHandle;
+		SetHandleInformation ((HANDLE) stdoutHandle, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+	}
 	
-	char *cmdlineBuf = new char[65536];
-	strncpy (cmdlineBuf, cmdline.c_str(), 65536);
-
-	BOOL rc = CreateProcess (NULL, cmdlineBuf, NULL, NULL, TRUE, 0, envBlock, NULL, &startupInfo, &procInfo);
+	memset (&procInfo, 0, sizeof (PROCESS_INFORMATION));
 	
-	delete cmdlineBuf;
+	process.commandLine = cmdline;
 	
-	if (!rc) 
-		throw runtime_error ("CreateProcess() failed.");
-		
-	if (capture_stdout) {
+	HANDLE hLog = INVALID_HANDLE_VALUE;
 	
-		CloseHandle (hStdoutWrite);
-
-		while (true) {
-
-			char buf[1024+1];
-			DWORD gotSize = 0;
-			
-			int rc = ReadFile (hStdoutRead, buf, 1024, &gotSize, 0);
-			if (rc == 0)
-				break;
-
-			buf[gotSize] = 0;
-			(*capture_stdout) += string (buf);
-			
-		}	
+	if (console.isBuffered ()) {
 		
-		CloseHandle (hStdoutRead);
+		char tempDir[MAX_PATH], tempName[MAX_PATH];
+		GetTempPath (MAX_PATH, tempDir);
+		GetTempFileName (tempDir, "lck", 0, tempName);
 		
-	}
+		hLog = CreateFile (tempName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
 		
-	WaitForSingleObject (procInfo.hProcess, INFINITE);
+		if (hLog != INVALID_HANDLE_VALUE) {
+			SetHandleInformation (hLog, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+			startupInfo.hStdError = hLog;
+			if (!captureStdout && stdoutHandle == -1)
+				startupInfo.hStdOutput = hLog;
+		}
+		
+	}
 	
-	DWORD exitCode = 0xFFFFFFFF;
+	// without a log file the command writes straight to the console, as with -j 1
 	
-	GetExitCodeProcess (procInfo.hProcess, &exitCode);
+	if (hLog != INVALID_HANDLE_VALUE)
+		console.commandStarted (cmdline);
+	else {
+		console.write ("run: \"" + cmdline + "\"\n");
+		cout.flush ();
+	}
 	
-	CloseHandle (procInfo.hThread);
-	CloseHandle (procInfo.hProcess);
+	char *cmdlineBuf = new char[65536];
+	strncpy (cmdlineBuf, cmdline.c_str(), 65536);
+
+	BOOL rc = CreateProcess (NULL, cmdlineBuf, NULL, NULL, TRUE, 0, envBlock, NULL, &startupInfo, &procInfo);
+	
+	delete[] cmdlineBuf;
+	
+	if (stdinHandle != -1)
+		SetHandleInformation ((HANDLE) stdinHandle, HANDLE_FLAG_INHERIT, 0);
+	
+	if (stdoutHandle != -1)
+		SetHandleInformation ((HANDLE) stdoutHandle, HANDLE_FLAG_INHERIT, 0);
+	
+	if (hLog != INVALID_HANDLE_VALUE)
+		SetHandleInformation (hLog, HANDLE_FLAG_INHERIT, 0);
 	
 	if (envBlock != NULL)
 		free (envBlock);
 	
-	cout << "exit code: " << exitCode << endl;
+	if (captureStdout)
+		CloseHandle (hStdoutWrite);
 	
-	return (int) exitCode;
+	if (!rc) {
+		if (captureStdout)
+			CloseHandle (hStdoutRead);
+		if (hLog != INVALID_HANDLE_VALUE)
+			CloseHandle (hLog);
+		return false;
+	}
+	
+	CloseHandle (procInfo.hThread);
+	
+	process.handle = (intptr_t) procInfo.hProcess;
+	process.stdoutPipe = captureStdout ? (intptr_t) hStdoutRead : -1;
+	process.logFile = (hLog != INVALID_HANDLE_VALUE) ? (intptr_t) hLog : -1;
+	
+	return true;
 	
 #else
 	
@@ -499,103 +963,392 @@ int runCommand (const list<string>& params, string *capture_stdout, map<string,s
 	
 	
 	char **args = new char* [params.size () + 1];
-	int rc = -1;
 	int i = 0;
 	
-	cout << "run:";
-	
 	for (list<string>::const_iterator it = params.begin (); it != params.end (); it++) {
-		cout << " " << (*it);
+		if (i > 0)
+			process.commandLine += " ";
+		process.commandLine += (*it);
 		args[i] = strdup (string (*it).c_str());
 		i ++;
 	}
 	
 	args[params.size()] = NULL;
 	
-	cout << endl;
+	int logFd = -1;
+	
+	if (console.isBuffered ()) {
+		
+		const char *tempDir = getenv ("TMPDIR");
+		string tempName = string ((tempDir != NULL && tempDir[0] != 0) ? tempDir : "/tmp") + "/lick-XXXXXX";
+		
+		char *nameBuf = strdup (tempName.c_str ());
+		logFd = mkostemp (nameBuf, O_CLOEXEC);
+		if (logFd != -1)
+			unlink (nameBuf);
+		free (nameBuf);
+		
+	}
+	
+	// without a log file the command writes straight to the console, as with -j 1
+	
+	if (logFd != -1)
+		console.commandStarted (process.commandLine);
+	else {
+		console.write ("run: " + process.commandLine + "\n");
+		cout.flush ();
+	}
 	
 	int pipe_fds[2];
 	
-	if (capture_stdout != NULL)
+	if (captureStdout)
 		pipe (pipe_fds);
 	
 	pid_t child_pid = fork();
 	
 	if (child_pid == 0) { // child
 		
-		if (stdout != NULL) {
+		if (captureStdout) {
 			dup2 (pipe_fds[1], STDOUT_FILENO);
 			close (pipe_fds[0]);
 		}
 		
+		if (stdinHandle != -1)
+			dup2 ((int) stdinHandle, STDIN_FILENO);
+		
+		if (stdoutHandle != -1)
+			dup2 ((int) stdoutHandle, STDOUT_FILENO);
+		
+		if (logFd != -1) {
+			dup2 (logFd, STDERR_FILENO);
+			if (!captureStdout && stdoutHandle == -1)
+				dup2 (logFd, STDOUT_FILENO);
+		}
+		
 		if (envp != NULL)
 			execvpe (args[0], args, envp);
 		else
 			execvp (args[0], args);
 		
-		exit (-1);
+		// _exit, the child must not run the destructors of, or flush, what it shares with
+		// the parent: the hash store's flush thread would terminate it, for one
+		
+		_exit (127);
 		
-    } else if (child_pid < 0) { // failed fork ()
+	}
 	
-		return -1;
+	if (captureStdout) 
+		close (pipe_fds[1]);
+	
+	if (envp != NULL) {
+		for (i = 0; envp[i]; i++)
+			free (envp[i]);
+		delete[] envp;
+	}
+	
+	for (size_t i = 0; i < params.size(); i++) 
+		free (args[i]);
+	
+	delete[] args;
+	
+	if (child_pid < 0) { // failed fork ()
+		if (captureStdout)
+			close (pipe_fds[0]);
+		if (logFd != -1)
+			close (logFd);
+		return false;
+	}
+	
+	process.handle = child_pid;
+	process.stdoutPipe = captureStdout ? pipe_fds[0] : -1;
+	process.logFile = logFd;
+	
+	return true;
+
+#endif
+
+}
+
+int finishCommand (CChildProcess& process, string *capture_stdout) {
+
+#ifdef _MSC_VER
+
+	HANDLE hProcess = (HANDLE) process.handle;
+	
+	if (process.stdoutPipe != -1) {
+	
+		HANDLE hStdoutRead = (HANDLE) process.stdoutPipe;
+
+		while (true) {
+
+			char buf[1024+1];
+			DWORD gotSize = 0;
+			
+			int rc = ReadFile (hStdoutRead, buf, 1024, &gotSize, 0);
+			if (rc == 0)
+				break;
+
+			buf[gotSize] = 0;
+			if (capture_stdout)
+				(*capture_stdout) += string (buf);
+			
+		}	
+		
+		CloseHandle (hStdoutRead);
+		
+	}
+		
+	WaitForSingleObject (hProcess, INFINITE);
+	
+	DWORD exitCode = 0xFFFFFFFF;
+	
+	GetExitCodeProcess (hProcess, &exitCode);
+	
+	CloseHandle (hProcess);
+	
+	if (process.logFile != -1) {
+		
+		HANDLE hLog = (HANDLE) process.logFile;
+		string log = "run: \"" + process.commandLine + "\"\n";
+		
+		SetFilePointer (hLog, 0, NULL, FILE_BEGIN);
 		
-	} else { // parent
+		char buf[4096];
+		DWORD gotSize = 0;
+		while (ReadFile (hLog, buf, sizeof (buf), &gotSize, 0) && gotSize > 0)
+			log.append (buf, gotSize);
 		
-		if (capture_stdout != NULL) {
+		CloseHandle (hLog);
+		process.logFile = -1;
 		
-			close (pipe_fds[1]);
+		console.commandFinished (process.commandLine, log, (int) exitCode);
+		
+	} else {
+		stringstream ss;
+		ss << "exit code: " << exitCode << "\n";
+		console.write (ss.str ());
+	}
+	
+	return (int) exitCode;
+	
+#else
+
+	int rc = -1;
+	int fd = process.stdoutPipe;
+	
+	if (fd != -1) {
+	
+		fd_set rfds, efds;
+		
+		while (true) {
 			
-			fd_set rfds, efds;
+			char buf[1024];
 			
-			while (true) {
-				
-				char buf[1024];
-				
-				FD_ZERO (&rfds);
-				FD_ZERO (&efds);
-				FD_SET (pipe_fds [0], &rfds); 				
-				FD_SET (pipe_fds [0], &efds); 				
+			FD_ZERO (&rfds);
+			FD_ZERO (&efds);
+			FD_SET (fd, &rfds); 				
+			FD_SET (fd, &efds); 				
+			
+			select (fd + 1, &rfds, NULL, &efds, NULL); 
+			if (FD_ISSET (fd, &rfds)) {
 				
-				select (pipe_fds[0] + 1, &rfds, NULL, &efds, NULL); 
-				if (FD_ISSET (pipe_fds[0], &rfds)) {
-					
-					int rc = read (pipe_fds[0], buf, 1023);
-					if (rc > 0) {
-						buf[rc] = 0;
+				int rc = read (fd, buf, 1023);
+				if (rc > 0) {
+					buf[rc] = 0;
+					if (capture_stdout)
 						(*capture_stdout) += string (buf);
-					} else
-						break;
-				}
-				
-				if (FD_ISSET (pipe_fds[0], &efds)) 
+				} else
 					break;
-				
 			}
-		} 
 			
-		waitpid (child_pid, &rc, 0);
+			if (FD_ISSET (fd, &efds)) 
+				break;
+			
+		}
+		
+		close (fd);
+	} 
+		
+	waitpid ((pid_t) process.handle, &rc, 0);
+	
+	if (process.brokenPipeOk && WIFSIGNALED (rc) && WTERMSIG (rc) == SIGPIPE)
+		rc = 0;
+	
+	if (process.logFile != -1) {
+		
+		string log = "run: " + process.commandLine + "\n";
+		
+		lseek ((int) process.logFile, 0, SEEK_SET);
+		
+		char buf[4096];
+		ssize_t got;
+		while ((got = read ((int) process.logFile, buf, sizeof (buf))) > 0)
+			log.append (buf, got);
+		
+		close ((int) process.logFile);
+		process.logFile = -1;
+		
+		int exitCode = WIFEXITED (rc) ? WEXITSTATUS (rc) : (WIFSIGNALED (rc) ? 128 + WTERMSIG (rc) : rc);
+		console.commandFinished (process.commandLine, log, exitCode);
 		
 	}
 	
-	if (oldpath != NULL) {
-		putenv (oldpath);
+	return rc;
+
+#endif
+
+}
+
+int runCommand (const list<string>& params, string *capture_stdout, map<string,string>* env) {
+
+	CChildProcess process;
+	
+	if (!startCommand (params, capture_stdout != NULL, env, process)) {
+#ifdef _MSC_VER
+		throw runtime_error ("CreateProcess() failed.");
+#else
+		return -1;
+#endif
 	}
 	
-	if (envp != NULL) {
-		for (i = 0; envp[i]; i++)
-			free (envp[i]);
-		delete envp;
+	CReleaseInterpreter unlocked;
+	return finishCommand (process, capture_stdout);
+	
+}
+
+
+/*
+	Runs commands[0] | commands[1] | ... with kernel pipes between them; data never passes
+	through lick. The whole pipeline fails (returns the first non-zero exit code) if any
+	stage fails, like "set -o pipefail".
+*/
+
+int runPipeline (const vector<list<string>>& commands, map<string,string>* env, const string& inputFile, const string& outputFile, bool appendOutput) {
+
+	vector<CChildProcess> processes (commands.size ());
+	size_t started = 0;
+	
+#ifdef _MSC_VER
+
+	HANDLE input = INVALID_HANDLE_VALUE, output = INVALID_HANDLE_VALUE;
+	
+	if (!inputFile.empty ()) {
+		input = CreateFile (inputFile.c_str (), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (input == INVALID_HANDLE_VALUE)
+			throw runtime_error ("Failed to open " + inputFile);
 	}
 	
-	for (size_t i = 0; i < params.size(); i++) 
-		free (args[i]);
+	if (!outputFile.empty ()) {
+		output = CreateFile (outputFile.c_str (), GENERIC_WRITE, FILE_SHARE_READ, NULL, appendOutput ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (output == INVALID_HANDLE_VALUE) {
+			if (input != INVALID_HANDLE_VALUE)
+				CloseHandle (input);
+			throw runtime_error ("Failed to open " + outputFile);
+		}
+		if (appendOutput)
+			SetFilePointer (output, 0, NULL, FILE_END);
+	}
 	
-	delete args;
+	HANDLE prevRead = input;
 	
-	return rc;
+	for (size_t i = 0; i < commands.size (); i++) {
+		
+		HANDLE pipeRead = INVALID_HANDLE_VALUE, pipeWrite = output;
+		
+		if (i + 1 < commands.size ())
+			CreatePipe (&pipeRead, &pipeWrite, NULL, 0);
+		
+		bool ok = startCommand (commands[i], false, env, processes[i], 
+			(prevRead != INVALID_HANDLE_VALUE) ? (intptr_t) prevRead : -1, 
+			(pipeWrite != INVALID_HANDLE_VALUE) ? (intptr_t) pipeWrite : -1);
+		
+		if (prevRead != INVALID_HANDLE_VALUE)
+			CloseHandle (prevRead);
+		if (i + 1 < commands.size ())
+			CloseHandle (pipeWrite);
+		
+		prevRead = pipeRead;
+		
+		if (!ok)
+			break;
+		
+		started ++;
+		
+	}
+	
+	if (prevRead != INVALID_HANDLE_VALUE)
+		CloseHandle (prevRead);
+	if (output != INVALID_HANDLE_VALUE)
+		CloseHandle (output);
+	
+#else
+
+	int input = -1, output = -1;
+	
+	if (!inputFile.empty ()) {
+		input = open (inputFile.c_str (), O_RDONLY | O_CLOEXEC);
+		if (input == -1)
+			throw runtime_error ("Failed to open " + inputFile);
+	}
+	
+	if (!outputFile.empty ()) {
+		output = open (outputFile.c_str (), O_WRONLY | O_CREAT | O_CLOEXEC | (appendOutput ? O_APPEND : O_TRUNC), 0666);
+		if (output == -1) {
+			if (input != -1)
+				close (input);
+			throw runtime_error ("Failed to open " + outputFile);
+		}
+	}
+	
+	int prevRead = input;
+	
+	for (size_t i = 0; i < commands.size (); i++) {
+		
+		int fds[2] = { -1, output };
+		
+		if (i + 1 < commands.size () && pipe2 (fds, O_CLOEXEC) != 0)
+			break;
+		
+		bool ok = startCommand (commands[i], false, env, processes[i], prevRead, fds[1]);
+		
+		if (prevRead != -1)
+			close (prevRead);
+		if (i + 1 < commands.size ())
+			close (fds[1]);
+		
+		prevRead = fds[0];
+		
+		if (!ok)
+			break;
+		
+		started ++;
+		
+	}
+	
+	// if a stage failed to start, the ones before it get EPIPE and finish
+	
+	if (prevRead != -1)
+		close (prevRead);
+	if (output != -1)
+		close (output);
 
 #endif
 
+	int exitCode = (started == commands.size ()) ? 0 : -1;
+	
+	CReleaseInterpreter unlocked;
+	
+	for (size_t i = 0; i < started; i++) {
+		// a reader that stops early (head) is not a failure of the writer
+		processes[i].brokenPipeOk = i + 1 < commands.size ();
+		
+		int rc = finishCommand (processes[i], NULL);
+		if (rc != 0 && exitCode == 0)
+			exitCode = rc;
+	}
+	
+	return exitCode;
+
 }
 
 string getCurrentDirectory () {
@@ -612,6 +1365,19 @@ string getCurrentDirectory () {
 	
 }
 
+/*
+	The .lick directory in which what lick learns about a project is kept between runs: the
+	one next to moduleName, or in the current directory when there is no module yet.
+*/
+
+string getStateDirectory (const string& moduleName) {
+
+	string dirName = moduleName.empty () ? getCurrentDirectory () : moduleName.substr (0, moduleName.find_last_of (getAnyPathSeparator ()));
+	
+	return dirName + getPathSeparator () + ".lick";
+
+}
+
 void setCurrentDirectory (const string& dirPath) {
 	
 	int rc;
@@ -711,7 +1477,15 @@ string getAbsolutePath (const string& relPath) {
 #else
 
 	char buf[FILENAME_MAX];
-	realpath (makeSysSeparators(relPath).c_str(), buf);
+	string sysPath = makeSysSeparators (relPath);
+	
+	if (realpath (sysPath.c_str(), buf) == NULL) {
+		// no such file: resolve against cwd without touching the file system
+		if (isAbsolutePath (sysPath))
+			return sysPath;
+		return getCurrentDirectory () + getPathSeparator () + sysPath;
+	}
+	
 	return string (buf);
 	
 #endif
@@ -774,6 +1548,54 @@ bool getFileInfo (const string& fileName, long* size, time_t* mtime) {
 	
 }
 
+bool getFileStat (const string& fileName, CFileStat& fileStat) {
+
+#ifdef _MSC_VER
+
+	HANDLE hFile = CreateFile (makeSysSeparators (fileName).c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	
+	BY_HANDLE_FILE_INFORMATION fileInfo;
+	FILE_BASIC_INFO basicInfo;
+	
+	if (GetFileInformationByHandle (hFile, &fileInfo) == 0 || GetFileInformationByHandleEx (hFile, FileBasicInfo, &basicInfo, sizeof (basicInfo)) == 0) {
+		CloseHandle (hFile);
+		return false;
+	}
+	
+	// file times count 100ns intervals since 1601, moved to the unix epoch like st_mtim
+	
+	const uint64_t epochOffset = 116444736000000000ULL;
+	
+	fileStat.inode = ((uint64_t) fileInfo.nFileIndexHigh << 32) | fileInfo.nFileIndexLow;
+	fileStat.size = ((uint64_t) fileInfo.nFileSizeHigh << 32) | fileInfo.nFileSizeLow;
+	fileStat.mtimeNs = ((uint64_t) basicInfo.LastWriteTime.QuadPart - epochOffset) * 100;
+	fileStat.ctimeNs = ((uint64_t) basicInfo.ChangeTime.QuadPart - epochOffset) * 100;
+	fileStat.directory = (fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+	
+	CloseHandle (hFile);
+	return true;
+
+#else
+
+	struct stat s;
+	
+	if (stat (makeSysSeparators (fileName).c_str(), &s) != 0)
+		return false;
+	
+	fileStat.inode = s.st_ino;
+	fileStat.size = s.st_size;
+	fileStat.mtimeNs = (uint64_t) s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+	fileStat.ctimeNs = (uint64_t) s.st_ctim.tv_sec * 1000000000 + s.st_ctim.tv_nsec;
+	fileStat.directory = S_ISDIR (s.st_mode);
+	
+	return true;
+	
+#endif
+
+}
+
 #ifdef _MSC_VER
 
 typedef BOOL (WINAPI *LPFN_ISWOW64PROCESS) (HANDLE, PBOOL);
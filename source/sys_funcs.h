@@ -2,26 +2,167 @@
 #define __SYS_FUNCS_H__
 
 #include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <list>
 #include <string>
 #include <map>
+#include <vector>
 
 using namespace std;
 
+class CChildProcess {
+	
+	public:
+	
+		intptr_t handle;		// pid on unix, process HANDLE on windows
+		intptr_t stdoutPipe;	// read end of captured stdout, or -1
+		intptr_t logFile;		// temp file with the command's output when the console is buffered, or -1
+		string commandLine;
+		bool brokenPipeOk;		// pipeline stage whose reader may stop early
+		
+		CChildProcess () {
+			handle = -1;
+			stdoutPipe = -1;
+			logFile = -1;
+			brokenPipeOk = false;
+		}
+	
+};
+
+/*
+	What a file looks like from the outside; ctime changes on any rewrite, even one which
+	restores the old mtime. Times are in nanoseconds, as precise as the filesystem keeps them.
+*/
+
+class CFileStat {
+	
+	public:
+	
+		uint64_t inode;
+		uint64_t size;
+		uint64_t mtimeNs;
+		uint64_t ctimeNs;
+		bool directory;
+		
+		CFileStat () {
+			inode = 0;
+			size = 0;
+			mtimeNs = 0;
+			ctimeNs = 0;
+			directory = false;
+		}
+		
+		bool operator== (const CFileStat& other) const {
+			return inode == other.inode && size == other.size && mtimeNs == other.mtimeNs && ctimeNs == other.ctimeNs
+					&& directory == other.directory;
+		}
+	
+};
+
+/*
+	Read-only view of a whole file, mapped into memory.
+*/
+
+class CMappedFile {
+	
+	private:
+	
+		const char *data;
+		size_t size;
+		intptr_t fileHandle;
+		intptr_t mappingHandle;
+		
+		CMappedFile (const CMappedFile&);
+		CMappedFile& operator= (const CMappedFile&);
+		
+	public:
+	
+		CMappedFile () {
+			data = NULL;
+			size = 0;
+			fileHandle = -1;
+			mappingHandle = -1;
+		}
+		
+		~CMappedFile () {
+			close ();
+		}
+		
+		bool open (const string& fileName);
+		void close ();
+		
+		const char *getData () {
+			return data;
+		}
+		
+		size_t getSize () {
+			return size;
+		}
+	
+};
+
+/*
+	Advisory lock on a whole file, shared or exclusive, held by the process (fcntl record
+	locks on unix, LockFileEx on windows). On unix a held lock changes mode without being
+	released in between; on windows it is released and taken again.
+*/
+
+class CFileLock {
+	
+	private:
+	
+		intptr_t fileHandle;
+		bool locked;
+		
+		CFileLock (const CFileLock&);
+		CFileLock& operator= (const CFileLock&);
+		
+	public:
+	
+		CFileLock () {
+			fileHandle = -1;
+			locked = false;
+		}
+		
+		~CFileLock () {
+			close ();
+		}
+		
+		bool open (const string& fileName);
+		void close ();
+		
+		bool lock (bool exclusive, bool wait);
+		void unlock ();
+	
+};
+
 string getPathSeparator ();
 string getAnyPathSeparator ();
 string makeSysSeparators (const string& path);
 bool fileExists (const string& path);
 list<string> getFilesInPath (const string& path);
 int runCommand (const list<string>& params, string *capture_stdout, map<string,string>* env);
+bool startCommand (const list<string>& params, bool captureStdout, map<string,string>* env, CChildProcess& process, intptr_t stdinHandle = -1, intptr_t stdoutHandle = -1);
+int finishCommand (CChildProcess& process, string *capture_stdout);
+int runPipeline (const vector<list<string>>& commands, map<string,string>* env, const string& inputFile, const string& outputFile, bool appendOutput);
 string getCurrentDirectory ();
+string getStateDirectory (const string& moduleName);
 void setCurrentDirectory (const string& dirPath);
 void makeDirs (const string& dirPath);
 string getAbsolutePath (const string& relPath);
 bool isAbsolutePath (const string& path);
 bool getFileInfo (const string& fileName, long* size, time_t* mtime);
+bool getFileStat (const string& fileName, CFileStat& fileStat);
 void deleteFileOrDir (const string& path);
 void copyFile (const string& path, const string& to);
+bool cloneFile (const string& from, const string& to, bool allowHardLink);
+void touchFile (const string& path);
+int getLinkCount (const string& path);
+bool replaceFile (const string& from, const string& to);
+bool writeFileAtomically (const string& fileName, const string& contents);
+bool syncFile (FILE *file);
+FILE *openAppendFile (const string& fileName);
 string getComputerName ();
 string getUserName ();
 string getPlatform ();
@@ -0,0 +1,46 @@
+#!/bin/sh
+
+# Two lick processes share the hash store: "all 3" records its hashes and keeps running
+# while "all 4" loads the store and records its own. Neither run overlapped the other's
+# writes, yet both were live at once, so the next "all 3" must find its block up to date.
+#
+# usage: hashstore_concurrent.sh <lick binary>
+
+lick="$1"
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir" || exit 1
+
+echo 3 > in3.txt
+echo 4 > in4.txt
+
+cat > lickable <<'LICKABLE'
+target all (n) {
+	depends ("in" + n + ".txt") {
+		run ("true", "built", n);
+	}
+	run ("sleep", "2");
+}
+LICKABLE
+
+"$lick" all 3 > first.log 2>&1 &
+first=$!
+sleep 1
+"$lick" all 4 > second.log 2>&1 || { cat second.log; exit 1; }
+wait $first || { cat first.log; exit 1; }
+
+grep -q "run: true built 3" first.log && grep -q "run: true built 4" second.log || {
+	echo "the concurrent runs did not build"
+	cat first.log second.log
+	exit 1
+}
+
+"$lick" all 3 > third.log 2>&1 || { cat third.log; exit 1; }
+
+if grep -q "run: true built 3" third.log; then
+	echo "the hashes of the first run were lost"
+	exit 1
+fi
+
+exit 0
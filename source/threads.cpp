@@ -0,0 +1,198 @@
+#include <stdexcept>
+
+#include "threads.h"
+#include "sys_funcs.h"
+#include "history.h"
+
+CInterpreterLock interpreterLock;
+
+static mutex directoriesLock;
+static int jobCount = 1;
+
+void CInterpreterLock::acquire () {
+
+	lock.lock ();
+
+	string dirPath;
+	{
+		lock_guard<mutex> guard (directoriesLock);
+		map<thread::id,string>::iterator it = threadDirectories.find (this_thread::get_id ());
+		if (it != threadDirectories.end ())
+			dirPath = it -> second;
+	}
+
+	if (!dirPath.empty () && dirPath != getCurrentDirectory ()) {
+		try {
+			setCurrentDirectory (dirPath);
+		} catch (exception& e) {
+			// directory is gone; keep running wherever we are, the script will fail on its own
+		}
+	}
+
+}
+
+void CInterpreterLock::release () {
+
+	setThreadDirectory (getCurrentDirectory ());
+	lock.unlock ();
+
+}
+
+void CInterpreterLock::setThreadDirectory (const string& dirPath) {
+
+	lock_guard<mutex> guard (directoriesLock);
+	threadDirectories[this_thread::get_id ()] = dirPath;
+
+}
+
+CWorkerPool::CWorkerPool (int threadCount) {
+
+	if (threadCount < 1)
+		threadCount = 1;
+
+	pending = 0;
+	stopping = false;
+	nextQueue = 0;
+	startDirectory = getCurrentDirectory ();
+
+	queues.resize (threadCount);
+	for (int i = 0; i < threadCount; i++)
+		threads.push_back (thread (&CWorkerPool::workerLoop, this, (size_t) i));
+
+}
+
+CWorkerPool::~CWorkerPool () {
+
+	{
+		lock_guard<mutex> guard (poolLock);
+		stopping = true;
+	}
+	poolSignal.notify_all ();
+
+	CReleaseInterpreter unlocked;
+
+	for (vector<thread>::iterator it = threads.begin (); it != threads.end (); it++)
+		it -> join ();
+
+}
+
+size_t CWorkerPool::getWorkerIndex () {
+
+	thread::id self = this_thread::get_id ();
+
+	for (size_t i = 0; i < threads.size (); i++) {
+		if (threads[i].get_id () == self)
+			return i;
+	}
+
+	size_t index = nextQueue;
+	nextQueue = (nextQueue + 1) % queues.size ();
+	return index;
+
+}
+
+void CWorkerPool::submit (function<void()> task) {
+
+	// commands the task starts count for the timers around the submitter
+
+	CDurationTimer *timer = CDurationTimer::getCurrent ();
+
+	{
+		lock_guard<mutex> guard (poolLock);
+		queues[getWorkerIndex ()].push_back ([task, timer] () {
+			CDurationTimer::setCurrent (timer);
+			task ();
+		});
+		pending ++;
+	}
+	poolSignal.notify_all ();
+
+}
+
+bool CWorkerPool::takeTask (size_t index, function<void()>& task) {
+
+	if (!queues[index].empty ()) {
+		task = queues[index].back ();
+		queues[index].pop_back ();
+		return true;
+	}
+
+	for (size_t i = 1; i < queues.size (); i++) {
+		deque<function<void()>>& victim = queues[(index + i) % queues.size ()];
+		if (!victim.empty ()) {
+			task = victim.front ();
+			victim.pop_front ();
+			return true;
+		}
+	}
+
+	return false;
+
+}
+
+void CWorkerPool::workerLoop (size_t index) {
+
+	while (true) {
+
+		function<void()> task;
+
+		{
+			unique_lock<mutex> guard (poolLock);
+			while (!stopping && !takeTask (index, task))
+				poolSignal.wait (guard);
+
+			if (!task)
+				return;
+		}
+
+		interpreterLock.setThreadDirectory (startDirectory);
+
+		try {
+			task ();
+		} catch (...) {
+			lock_guard<mutex> guard (poolLock);
+			if (!firstError)
+				firstError = current_exception ();
+		}
+
+		{
+			lock_guard<mutex> guard (poolLock);
+			pending --;
+		}
+		poolSignal.notify_all ();
+
+	}
+
+}
+
+void CWorkerPool::wait () {
+
+	{
+		CReleaseInterpreter unlocked;
+		unique_lock<mutex> guard (poolLock);
+		while (pending > 0)
+			poolSignal.wait (guard);
+	}
+
+	if (firstError) {
+		exception_ptr error = firstError;
+		firstError = exception_ptr ();
+		rethrow_exception (error);
+	}
+
+}
+
+bool CWorkerPool::failed () {
+
+	lock_guard<mutex> guard (poolLock);
+	return (bool) firstError;
+
+}
+
+void setJobCount (int jobs) {
+	jobCount = (jobs < 1) ? 1 : jobs;
+}
+
+int getJobCount () {
+	return jobCount;
+}
@@ -0,0 +1,114 @@
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+using namespace std;
+
+/*
+	Interpreter state (values, contexts, hash store, current directory) is not thread-safe,
+	so every thread that evaluates script code must hold the interpreter lock. It is released
+	only around blocking work (waiting for child processes, hashing files, waiting for workers).
+
+	The current directory is process-wide, so each thread's cwd is remembered on release and
+	restored on acquire; this way cd() inside one target does not leak into another.
+*/
+
+class CInterpreterLock {
+
+	private:
+
+		mutex lock;
+		map<thread::id,string> threadDirectories;
+
+	public:
+
+		void acquire ();
+		void release ();
+
+		void setThreadDirectory (const string& dirPath);
+
+};
+
+extern CInterpreterLock interpreterLock;
+
+class CReleaseInterpreter {
+
+	public:
+
+		CReleaseInterpreter () {
+			interpreterLock.release ();
+		}
+
+		~CReleaseInterpreter () {
+			interpreterLock.acquire ();
+		}
+
+};
+
+class CHoldInterpreter {
+
+	public:
+
+		CHoldInterpreter () {
+			interpreterLock.acquire ();
+		}
+
+		~CHoldInterpreter () {
+			interpreterLock.release ();
+		}
+
+};
+
+/*
+	Fixed set of worker threads with per-worker task deques. A worker runs its own tasks
+	newest first and steals the oldest task of another worker when it runs dry. Tasks
+	submitted from a worker go to that worker's deque, so follow-up work stays local.
+
+	Tasks run without the interpreter lock; tasks that evaluate script code take it
+	with CHoldInterpreter. The first exception thrown by a task is rethrown by wait ().
+*/
+
+class CWorkerPool {
+
+	private:
+
+		vector<deque<function<void()>>> queues;
+		vector<thread> threads;
+
+		mutex poolLock;
+		condition_variable poolSignal;
+
+		int pending;
+		bool stopping;
+		exception_ptr firstError;
+		string startDirectory;
+		size_t nextQueue;
+
+		void workerLoop (size_t index);
+		bool takeTask (size_t index, function<void()>& task);
+		size_t getWorkerIndex ();
+
+	public:
+
+		CWorkerPool (int threadCount);
+		~CWorkerPool ();
+
+		void submit (function<void()> task);
+		void wait ();
+		bool failed ();
+
+};
+
+void setJobCount (int jobs);
+int getJobCount ();
+
+#endif /* __THREADS_H__ */
@@ -1,6 +1,6 @@
 #include "value.h"
 
-void CValue::updateHash (SHA1& hash) {
+void CValue::updateHash (CFingerprint& hash) {
 
 	if (this == NULL)
 		hash.update ("null");
@@ -10,7 +10,7 @@
 #include <stdexcept>
 
 #include "sys_funcs.h"
-#include "sha1.h"
+#include "fingerprint.h"
 
 using namespace std;
 
@@ -36,7 +36,7 @@ class CValue {
 	
 	protected:
 	
-		virtual void updateHashArgs (SHA1& hash) = 0;
+		virtual void updateHashArgs (CFingerprint& hash) = 0;
 	
 	public:
 		
@@ -68,7 +68,7 @@ class CValue {
 			return 0;
 		}
 		
-		void updateHash (SHA1& hash);
+		void updateHash (CFingerprint& hash);
 
 };
 
@@ -80,7 +80,7 @@ class CValueRef: public CValue {
 		
 	protected:
 		
-		void updateHashArgs (SHA1& hash) {
+		void updateHashArgs (CFingerprint& hash) {
 			value -> updateHash (hash);
 		}
 		
@@ -114,7 +114,7 @@ class CVoidValue: public CValue {
 	
 	protected:
 		
-		void updateHashArgs (SHA1& hash) { }
+		void updateHashArgs (CFingerprint& hash) { }
 	
 	public:
 		
@@ -136,7 +136,7 @@ class CArrayValue: public CValue {
 	
 	protected:
 		
-		void updateHashArgs (SHA1& hash) {
+		void updateHashArgs (CFingerprint& hash) {
 			for (vector<shared_ptr<CValueRef>>::iterator it = values.begin(); it != values.end(); it++) {
 				hash.update ("ref:"); 
 				(*it) -> updateHash (hash);
@@ -202,6 +202,15 @@ class CArrayValue: public CValue {
 			return result;
 		}
 
+		static CArrayValue *make_copy (shared_ptr<CValue> arr) {
+		
+			CArrayValue *result = new CArrayValue ();
+			for (int i = 0; i < arr -> getLength (); i++)
+				result -> append (shared_ptr<CValueRef> (new CValueRef (arr -> subscript (i))));
+			
+			return result;
+		}
+
 		static CArrayValue *make_prepend (shared_ptr<CValue> val, shared_ptr<CValue> arr) {
 		
 			CArrayValue *result = new CArrayValue ();
@@ -256,7 +265,7 @@ class CDictValue: public CValue {
 	
 	protected:
 		
-		void updateHashArgs (SHA1& hash) {
+		void updateHashArgs (CFingerprint& hash) {
 			for (map<string,shared_ptr<CValueRef>>::iterator it = values.begin(); it != values.end(); it++) {
 				hash.update ("key:");
 				hash.update (it -> first);
@@ -301,6 +310,18 @@ class CDictValue: public CValue {
 			values.insert (pair<string, shared_ptr<CValueRef>> (index, value));
 		}
 		
+		static CDictValue *make_copy (shared_ptr<CValue> dict) {
+		
+			CDictValue *result = new CDictValue ();
+			list<string> keys;
+			dict -> getKeys (keys);
+			
+			for (list<string>::iterator it = keys.begin (); it != keys.end (); it++)
+				result -> append (*it, shared_ptr<CValueRef> (new CValueRef (dict -> subscript (*it))));
+			
+			return result;
+		}
+		
 		shared_ptr<CValue> subscript (const string& index) {
 			
 			map<string,shared_ptr<CValueRef>>::iterator it = values.find (index);
@@ -344,7 +365,7 @@ class CIntValue: public CValue {
 	
 	protected:
 		
-		void updateHashArgs (SHA1& hash) {
+		void updateHashArgs (CFingerprint& hash) {
 			stringstream ss;
 			ss << intValue;
 			hash.update (ss.str());
@@ -380,7 +401,7 @@ class CStringValue: public CValue {
 
 	protected:
 		
-		void updateHashArgs (SHA1& hash) {
+		void updateHashArgs (CFingerprint& hash) {
 			hash.update (stringValue);
 		}
 		